@@ -0,0 +1,699 @@
+// Resident CD directory index
+//
+// CdSearchFile() may have to seek to (and re-read) a directory record on every
+// call, so every path the menu touches is resolved once and its LBA and size
+// are kept in a small open-addressed hash table. Loaders then only need a
+// single CdlSetloc before reading.
+
+#define CDINDEX_MAX		256		// Must be a power of two
+#define CDINDEX_NAMELEN	52		// Same as TITLESTRUCT.ExecFile
+#define CDINDEX_PATHLEN	128		// Longest path searched for, longer than NAMELEN isn't kept
+
+typedef struct {
+	char	name[CDINDEX_NAMELEN];
+	int		lba;
+	u_long	size;
+} CDINDEX;
+
+
+CDINDEX	CdIndex[CDINDEX_MAX];
+int		CdIndexCount=0;
+
+
+// Asynchronous reads
+//
+// There is only one drive so only one read is ever in flight. Starting a new
+// read or cancelling drops the current one, after which its handle reports
+// CDASYNC_IDLE. Completion callbacks run from the CD interrupt so they should
+// only set flags.
+
+#define CDASYNC_IDLE	0
+#define CDASYNC_BUSY	1
+#define CDASYNC_DONE	2
+#define CDASYNC_ERROR	3
+
+typedef struct {
+	int				Handle;
+	volatile int	Status;
+	int				Sectors;
+	int				Bytes;
+	CdlCB			Callback;
+} CDASYNC;
+
+
+CDASYNC	CdAsync={0};
+int		CdAsyncNext=1;
+
+
+// Read trace
+//
+// Seeks and reads issued through CdTraceSetloc()/CdTraceRead() are logged to
+// a ring buffer when CDTRACE is enabled so load times can be broken down into
+// seeks and transfers. Times are root counter 1 ticks (hblanks) with the frame
+// count alongside for anything longer than the counter wraps around in.
+
+#ifndef CDTRACE
+#define CDTRACE			false
+#endif
+
+#define CDTRACE_MAX		128		// Must be a power of two
+#define CDTRACE_TAGLEN	12
+#define CDTRACE_HZ		15734	// Hblanks per second (NTSC)
+
+typedef struct {
+	char	Tag[CDTRACE_TAGLEN];	// What is being read
+	int		Lba;
+	int		Sectors;				// 0 for streaming (XA) reads
+	int		Seek;					// Sectors from where the last read ended
+	u_short	Start,End;				// Root counter 1 when issued and when done
+	int		StartFrame,EndFrame;
+	int		Status;					// 0 while in flight, then the read's intr
+} CDTRACEREC;
+
+
+// Batch reads
+//
+// Loaders that need several files (or parts of one) at once queue them with
+// CdBatchAdd() and read them with CdBatchRun(), which goes through them in
+// ascending LBA order so the head never seeks backwards, and merges requests
+// that are contiguous both on the disc and in memory into a single read.
+// CdBatchStart()/CdBatchPoll() do the same in the background.
+
+#define CDBATCH_MAX		16
+
+typedef struct {
+	char*	Name;
+	int		Lba;
+	int		Sectors;
+	u_long*	Addr;
+	int		Done;
+} CDBATCH;
+
+
+CDBATCH	CdBatch[CDBATCH_MAX];
+int		CdBatchCount=0;
+int		CdBatchNext=0;		// First request not read yet
+int		CdBatchMerged=0;	// Requests in the read in flight
+
+
+CDTRACEREC		CdTrace[CDTRACE_MAX];
+int				CdTraceCount=0;		// Records written, CdTrace[] wraps around
+int				CdTraceLoc=0;		// Sector the next read starts at
+int				CdTraceHead=0;		// Sector after the end of the last read
+volatile int	CdTraceCur=-1;		// Record of the read in flight
+CdlCB			CdTraceDone=0;		// Callback of the read in flight
+
+
+void	CdIndexClear();
+u_long	CdIndexHash(char *name);
+CdlFILE	*CdIndexFile(CdlFILE *fp, char *name);
+int		CdIndexSetloc(char *name, u_long ssect, u_long *nsect);
+int		CdIndexAdd(char *name, int lba, u_long size);
+
+int		CdAsyncRead(char *name, u_long *addr, u_long ssect, u_long nsect, CdlCB callback);
+void	CdAsyncReady(u_char intr, u_char *result);
+int		CdAsyncStatus(int handle);
+int		CdAsyncProgress(int handle);
+void	CdAsyncCancel(int handle);
+int		CdAsyncBusy();
+
+void	CdBatchClear();
+int		CdBatchAdd(char *name, u_long ssect, u_long nsect, u_long *addr);
+int		CdBatchRun();
+void	CdBatchStart();
+int		CdBatchPoll();
+int		CdBatchLanded(u_long *addr);
+
+int		CdTraceSetloc(CdlLOC *pos);
+int		CdTraceRead(char *tag, int nsect, u_long *addr, int mode, CdlCB callback);
+void	CdTraceStream(char *tag, CdlLOC *pos);
+int		CdTraceBegin(char *tag, int lba, int nsect);
+void	CdTraceReady(u_char intr, u_char *result);
+int		CdTraceTicks(CDTRACEREC *rec);
+int		CdTraceRate(int *seeks);
+void	CdTraceDump();
+
+
+void CdIndexClear() {
+
+	int i;
+
+	for (i=0; i<CDINDEX_MAX; i++) {
+		CdIndex[i].name[0] = 0;
+	}
+	CdIndexCount = 0;
+
+}
+
+u_long CdIndexHash(char *name) {
+
+	// Hashes a path up to the ;1 version suffix so "\FILE" and "\FILE;1" match
+
+	u_long h=5381;
+
+	for (; (*name != 0) && (*name != ';'); name++) {
+		h = ((h << 5) + h) ^ (u_char)*name;
+	}
+
+	return h;
+
+}
+
+CdlFILE *CdIndexFile(CdlFILE *fp, char *name) {
+
+	// Drop-in replacement for CdSearchFile(). Only the pos and size fields of fp
+	// are filled in. Returns 0 if the file does not exist.
+
+	char	path[CDINDEX_PATHLEN+3];
+	int		i,len,slot=-1;
+
+	for (len=0; (name[len] != 0) && (name[len] != ';'); len++);
+	if (len > CDINDEX_PATHLEN) {
+		return 0;
+	}
+
+	// Names too long for the table are searched for every time
+	if (len < CDINDEX_NAMELEN) {
+		slot = CdIndexHash(name) & (CDINDEX_MAX - 1);
+		for (i=0; i<CDINDEX_MAX; i++) {
+			if (CdIndex[slot].name[0] == 0) break;
+			if ((strncmp(CdIndex[slot].name, name, len) == 0) && (CdIndex[slot].name[len] == 0)) {
+				CdIntToPos(CdIndex[slot].lba, &fp->pos);
+				fp->size = CdIndex[slot].size;
+				return fp;
+			}
+			slot = (slot + 1) & (CDINDEX_MAX - 1);
+		}
+	}
+
+	// Not indexed yet, search the disc with the version suffix appended
+	strncpy(path, name, len);
+	path[len] = 0;
+	strcat(path, ";1");
+
+	if (CdSearchFile(fp, path) == 0) {
+		return 0;
+	}
+
+	// Keep a quarter of the table free so probe chains stay short
+	if ((slot >= 0) && (CdIndexCount < ((CDINDEX_MAX * 3) / 4))) {
+		strncpy(CdIndex[slot].name, name, len);
+		CdIndex[slot].name[len] = 0;
+		CdIndex[slot].lba = CdPosToInt(&fp->pos);
+		CdIndex[slot].size = fp->size;
+		CdIndexCount++;
+	}
+
+	#if DEBUG
+	printf("Indexed %s at LBA %i (%i bytes)\n", path, CdPosToInt(&fp->pos), fp->size);
+	#endif
+
+	return fp;
+
+}
+
+int CdIndexSetloc(char *name, u_long ssect, u_long *nsect) {
+
+	// Seeks to sector ssect of a file. If *nsect is 0 it is set to the length
+	// of the whole file. Returns the number of bytes to read or -1 if the file
+	// does not exist. Any background read is dropped since it would lose the
+	// drive anyway.
+
+	CdlFILE	File;
+
+	CdAsyncCancel(0);
+
+	if (CdIndexFile(&File, name) == 0) {
+		return -1;
+	}
+
+	if (ssect > 0) {
+		CdIntToPos(CdPosToInt(&File.pos) + ssect, &File.pos);
+	}
+	CdTraceSetloc(&File.pos);
+
+	if (*nsect == 0) {
+		*nsect = (File.size + 2047) >> 11;
+		return File.size;
+	}
+
+	return *nsect << 11;
+
+}
+
+int CdIndexAdd(char *name, int lba, u_long size) {
+
+	// Indexes a file whose position is already known, e.g. from a patched
+	// VFS, so it is never searched for. Returns the LBA the index ends up
+	// with, the one found before if the file was already indexed.
+
+	int		i,len,slot;
+
+	for (len=0; (name[len] != 0) && (name[len] != ';'); len++);
+	if (len >= CDINDEX_NAMELEN) {
+		return lba;
+	}
+
+	slot = CdIndexHash(name) & (CDINDEX_MAX - 1);
+	for (i=0; i<CDINDEX_MAX; i++) {
+		if (CdIndex[slot].name[0] == 0) break;
+		if ((strncmp(CdIndex[slot].name, name, len) == 0) && (CdIndex[slot].name[len] == 0)) {
+			return CdIndex[slot].lba;
+		}
+		slot = (slot + 1) & (CDINDEX_MAX - 1);
+	}
+
+	if ((i < CDINDEX_MAX) && (CdIndexCount < ((CDINDEX_MAX * 3) / 4))) {
+		strncpy(CdIndex[slot].name, name, len);
+		CdIndex[slot].name[len] = 0;
+		CdIndex[slot].lba = lba;
+		CdIndex[slot].size = size;
+		CdIndexCount++;
+	}
+
+	return lba;
+
+}
+
+int CdAsyncRead(char *name, u_long *addr, u_long ssect, u_long nsect, CdlCB callback) {
+
+	// Starts reading a file (or part of it) in the background. Returns a handle
+	// for CdAsyncStatus()/CdAsyncProgress() or -1 if the file does not exist.
+
+	int bytes;
+
+	bytes = CdIndexSetloc(name, ssect, &nsect);
+	if (bytes < 0) {
+		printf("File not found: %s\n", name);
+		return -1;
+	}
+
+	CdAsync.Handle		= CdAsyncNext++;
+	CdAsync.Sectors		= nsect;
+	CdAsync.Bytes		= bytes;
+	CdAsync.Callback	= callback;
+	CdAsync.Status		= CDASYNC_BUSY;
+
+	if (CdTraceRead(name, nsect, addr, CdlModeSpeed, (CdlCB)CdAsyncReady) == 0) {
+		CdReadCallback(0);
+		CdAsync.Status = CDASYNC_ERROR;
+	}
+
+	#if DEBUG
+	printf("Async read %i: %s +%i, %i sectors\n", CdAsync.Handle, name, ssect, nsect);
+	#endif
+
+	return CdAsync.Handle;
+
+}
+
+void CdAsyncReady(u_char intr, u_char *result) {
+
+	if (CdAsync.Status != CDASYNC_BUSY) return;
+
+	if (intr == CdlComplete) {
+		CdAsync.Status = CDASYNC_DONE;
+	} else {
+		CdAsync.Status = CDASYNC_ERROR;
+	}
+
+	if (CdAsync.Callback) {
+		CdAsync.Callback(intr, result);
+	}
+
+}
+
+int CdAsyncStatus(int handle) {
+
+	int left;
+
+	if ((handle <= 0) || (handle != CdAsync.Handle)) {
+		return CDASYNC_IDLE;
+	}
+
+	// Don't rely on the callback alone in case another one replaced it
+	if (CdAsync.Status == CDASYNC_BUSY) {
+		left = CdReadSync(1, 0);
+		if (left == 0) {
+			CdAsync.Status = CDASYNC_DONE;
+		} else if (left < 0) {
+			CdAsync.Status = CDASYNC_ERROR;
+		}
+	}
+
+	return CdAsync.Status;
+
+}
+
+int CdAsyncProgress(int handle) {
+
+	// Returns how much of the read has completed in percent
+
+	int left;
+
+	switch (CdAsyncStatus(handle)) {
+		case CDASYNC_DONE:
+			return 100;
+		case CDASYNC_BUSY:
+			left = CdReadSync(1, 0);
+			if ((left <= 0) || (CdAsync.Sectors == 0)) return 100;
+			return ((CdAsync.Sectors - left) * 100) / CdAsync.Sectors;
+		default:
+			return 0;
+	}
+
+}
+
+void CdAsyncCancel(int handle) {
+
+	// Drops a background read. A handle of 0 cancels whatever is in flight.
+
+	if ((handle != 0) && (handle != CdAsync.Handle)) return;
+
+	if (CdAsync.Status == CDASYNC_BUSY) {
+		CdReadBreak();
+		#if DEBUG
+		printf("Async read %i cancelled\n", CdAsync.Handle);
+		#endif
+	}
+	CdReadCallback(0);
+
+	CdAsync.Handle = 0;
+	CdAsync.Status = CDASYNC_IDLE;
+
+}
+
+int CdAsyncBusy() {
+
+	// Returns true while a background read has the drive. Reads that do not
+	// go through CdAsyncRead() can be issued once this is false without
+	// dropping anything, the finished read keeps its handle.
+
+	return (CdAsyncStatus(CdAsync.Handle) == CDASYNC_BUSY);
+
+}
+
+void CdBatchClear() {
+	
+	CdBatchCount = 0;
+	
+}
+
+int CdBatchAdd(char *name, u_long ssect, u_long nsect, u_long *addr) {
+	
+	// Queues part of a file for CdBatchRun(). If nsect is 0 the whole file is
+	// read. Returns the number of bytes that will be read or -1 if the file
+	// does not exist or the batch is full.
+	
+	CdlFILE	File;
+	int		bytes;
+	
+	if (CdBatchCount == CDBATCH_MAX) {
+		printf("Read batch full: %s\n", name);
+		return -1;
+	}
+	
+	if (CdIndexFile(&File, name) == 0) {
+		printf("File not found: %s\n", name);
+		return -1;
+	}
+	
+	if (nsect == 0) {
+		nsect = (File.size + 2047) >> 11;
+		bytes = File.size;
+	} else {
+		bytes = nsect << 11;
+	}
+	
+	CdBatch[CdBatchCount].Name		= name;
+	CdBatch[CdBatchCount].Lba		= CdPosToInt(&File.pos) + ssect;
+	CdBatch[CdBatchCount].Sectors	= nsect;
+	CdBatch[CdBatchCount].Addr		= addr;
+	CdBatch[CdBatchCount].Done		= false;
+	CdBatchCount++;
+	
+	return bytes;
+	
+}
+
+int CdBatchRun() {
+	
+	// Reads everything queued with CdBatchAdd() and waits for it. Returns 0 if
+	// all of it was read or -1 if a read failed.
+	
+	int status;
+	
+	CdBatchStart();
+	while ((status = CdBatchPoll()) == CDASYNC_BUSY) {
+		CdReadSync(0, 0);
+	}
+	
+	return (status == CDASYNC_DONE) ? 0 : -1;
+	
+}
+
+void CdBatchStart() {
+	
+	// Sorts the batch and starts reading it, CdBatchPoll() does the rest
+	
+	CDBATCH	req;
+	int		i,j;
+	
+	// Insertion sort, batches are tiny
+	for (i=1; i<CdBatchCount; i++) {
+		req = CdBatch[i];
+		for (j=i; (j > 0) && (CdBatch[j-1].Lba > req.Lba); j--) {
+			CdBatch[j] = CdBatch[j-1];
+		}
+		CdBatch[j] = req;
+	}
+	
+	CdAsyncCancel(0);
+	CdBatchNext = 0;
+	CdBatchMerged = 0;
+	
+	CdBatchPoll();
+	
+}
+
+int CdBatchPoll() {
+	
+	// Starts the next read of the batch once the last one is in. Returns
+	// CDASYNC_BUSY while reading, then CDASYNC_DONE or CDASYNC_ERROR.
+	
+	CDBATCH	req;
+	CdlLOC	pos;
+	int		i,n;
+	
+	if (CdBatchMerged) {
+		n = CdReadSync(1, 0);
+		if (n > 0) return CDASYNC_BUSY;
+		if (n < 0) {
+			printf("Batch read failed: %s\n", CdBatch[CdBatchNext].Name);
+			CdBatchCount = 0;
+			CdBatchMerged = 0;
+			return CDASYNC_ERROR;
+		}
+		for (i=0; i<CdBatchMerged; i++) {
+			CdBatch[CdBatchNext + i].Done = true;
+		}
+		CdBatchNext += CdBatchMerged;
+		CdBatchMerged = 0;
+	}
+	
+	if (CdBatchNext >= CdBatchCount) return CDASYNC_DONE;
+	
+	req = CdBatch[CdBatchNext];
+	for (n=1; (CdBatchNext + n) < CdBatchCount; n++) {
+		if (CdBatch[CdBatchNext+n].Lba != (req.Lba + req.Sectors)) break;
+		if (CdBatch[CdBatchNext+n].Addr != (req.Addr + (req.Sectors << 9))) break;
+		req.Sectors += CdBatch[CdBatchNext+n].Sectors;
+	}
+	
+	#if DEBUG
+	printf("Batch read: %s at LBA %i, %i sectors (%i merged)\n", req.Name, req.Lba, req.Sectors, n);
+	#endif
+	
+	CdIntToPos(req.Lba, &pos);
+	CdTraceSetloc(&pos);
+	CdTraceRead(req.Name, req.Sectors, req.Addr, CdlModeSpeed, 0);
+	CdBatchMerged = n;
+	
+	return CDASYNC_BUSY;
+	
+}
+
+int CdBatchLanded(u_long *addr) {
+	
+	// True once the request reading to addr is in
+	
+	int i;
+	
+	for (i=0; i<CdBatchCount; i++) {
+		if (CdBatch[i].Addr == addr) return CdBatch[i].Done;
+	}
+	
+	return false;
+	
+}
+
+int CdTraceSetloc(CdlLOC *pos) {
+	
+	// CdControl(CdlSetloc) that remembers where the next read starts
+	
+	CdTraceLoc = CdPosToInt(pos);
+	
+	return CdControl(CdlSetloc, (u_char*)pos, 0);
+	
+}
+
+int CdTraceRead(char *tag, int nsect, u_long *addr, int mode, CdlCB callback) {
+	
+	// CdRead() from the last CdTraceSetloc() position. The callback is called
+	// from CdTraceReady() so it still sees every completed read.
+	
+	#if CDTRACE
+	CdTraceCur = CdTraceBegin(tag, CdTraceLoc, nsect);
+	CdTraceDone = callback;
+	CdReadCallback((CdlCB)CdTraceReady);
+	#else
+	CdReadCallback(callback);
+	#endif
+	CdTraceLoc += nsect;
+	
+	return CdRead(nsect, addr, mode);
+	
+}
+
+void CdTraceStream(char *tag, CdlLOC *pos) {
+	
+	// Logs the start of a streaming read (CdlReadS), which has no end
+	
+	#if CDTRACE
+	int i;
+	
+	i = CdTraceBegin(tag, CdPosToInt(pos), 0);
+	CdTrace[i].End = CdTrace[i].Start;
+	CdTrace[i].EndFrame = CdTrace[i].StartFrame;
+	CdTrace[i].Status = CdlComplete;
+	#endif
+	
+}
+
+int CdTraceBegin(char *tag, int lba, int nsect) {
+	
+	CDTRACEREC	*rec;
+	char		*name;
+	int			i;
+	
+	// Keep the file name only, the paths don't fit
+	for (name=tag; *tag != 0; tag++) {
+		if (*tag == '\\') name = tag + 1;
+	}
+	
+	// Counter 1 counts hblanks, free running over the whole 16 bits
+	if (CdTraceCount == 0) {
+		SetRCnt(RCntCNT1, 0xffff, RCntMdNOINTR);
+		StartRCnt(RCntCNT1);
+	}
+	
+	// Flush the trace before it starts overwriting itself, and before the
+	// record is stamped so the printing isn't timed
+	if ((CdTraceCount > 0) && ((CdTraceCount & (CDTRACE_MAX - 1)) == 0)) {
+		CdTraceDump();
+	}
+	
+	i = CdTraceCount & (CDTRACE_MAX - 1);
+	rec = &CdTrace[i];
+	
+	strncpy(rec->Tag, name, CDTRACE_TAGLEN - 1);
+	rec->Tag[CDTRACE_TAGLEN - 1] = 0;
+	rec->Lba		= lba;
+	rec->Sectors	= nsect;
+	rec->Seek		= lba - CdTraceHead;
+	rec->Start		= GetRCnt(RCntCNT1);
+	rec->StartFrame	= VSync(-1);
+	rec->Status		= 0;
+	
+	CdTraceHead = lba + nsect;
+	CdTraceCount++;
+	
+	return i;
+	
+}
+
+void CdTraceReady(u_char intr, u_char *result) {
+	
+	if (CdTraceCur >= 0) {
+		CdTrace[CdTraceCur].End			= GetRCnt(RCntCNT1);
+		CdTrace[CdTraceCur].EndFrame	= VSync(-1);
+		CdTrace[CdTraceCur].Status		= intr;
+		CdTraceCur = -1;
+	}
+	
+	if (CdTraceDone) {
+		CdTraceDone(intr, result);
+	}
+	
+}
+
+int CdTraceTicks(CDTRACEREC *rec) {
+	
+	// Duration of a read in hblanks
+	
+	int frames;
+	
+	if (rec->Status == 0) return 0;
+	
+	frames = rec->EndFrame - rec->StartFrame;
+	if (frames > 200) {
+		return frames * 263;
+	}
+	
+	return (u_short)(rec->End - rec->Start);
+	
+}
+
+int CdTraceRate(int *seeks) {
+	
+	// Returns the transfer rate over the reads in the trace in KB/s, and how
+	// many of them had to seek
+	
+	int i,n,sectors=0,ticks=0;
+	
+	*seeks = 0;
+	n = (CdTraceCount < CDTRACE_MAX) ? CdTraceCount : CDTRACE_MAX;
+	
+	for (i=0; i<n; i++) {
+		if ((CdTrace[i].Status == 0) || (CdTrace[i].Sectors == 0)) continue;
+		sectors += CdTrace[i].Sectors;
+		ticks += CdTraceTicks(&CdTrace[i]);
+		if (CdTrace[i].Seek != 0) (*seeks)++;
+	}
+	
+	if (ticks == 0) return 0;
+	
+	return (sectors * 2 * CDTRACE_HZ) / ticks;
+	
+}
+
+void CdTraceDump() {
+	
+	// Prints the trace oldest first
+	
+	CDTRACEREC	*rec;
+	int			i,n,ticks;
+	
+	n = (CdTraceCount < CDTRACE_MAX) ? CdTraceCount : CDTRACE_MAX;
+	
+	printf("CD trace, %i reads:\n", CdTraceCount);
+	printf("tag          lba     sectors seek    usec\n");
+	
+	for (i=CdTraceCount-n; i<CdTraceCount; i++) {
+		rec = &CdTrace[i & (CDTRACE_MAX - 1)];
+		ticks = CdTraceTicks(rec);
+		printf("%-12s %-7i %-7i %-7i %i%s\n", rec->Tag, rec->Lba, rec->Sectors, rec->Seek,
+			(ticks * 1000) / (CDTRACE_HZ / 1000), (rec->Status == CdlComplete) ? "" : " (error)");
+	}
+	
+}
@@ -41,6 +41,8 @@
 #include <rand.h>
 #include <libsnd.h>
 #include <libspu.h>
+#include <strings.h>
+#include <memory.h>
 
 #include "hitmod.h"
 
@@ -48,22 +50,109 @@
 #define false		0
 
 #define CENTERED	0x7FFF
-#define MALLOC_MAX	3
 
 // Toggles debug mode
 #define DEBUG	false
 
+// Toggles the CD read trace and its on-screen summary
+#define CDTRACE	false
+
 // Stuff you can change to suit your needs
 #define MENU_AREA			0x80010000
-#define MAX_TITLES			1024
-#define MENU_SIZE			MAX_TITLES*128
+#define MAX_TITLES			10240		// Entries a menu can have
+#define MENU_SIZE			(PATH_AREA+TITLEPATH_TEXT-MENU_AREA)
 #define MOD_AREA			0x80030000	// MUST BE MANUAL?
 #define TEMP_AREA			0x80030000	
 #define QLP_MAXSIZE			1024*128
 #define LISTFILE_MAXSIZE	1024*8
+#define LISTFILE_CHUNK		4			// Sectors per read, parsed while the next one comes in
+
+// Music is loaded to one of two slots so the next title can be read while
+// the current one keeps playing from the other
+#define SLOT_AREA			0x80130000	// Above the largest VFS pack loaded to MOD_AREA
+#define MOD_MAXSIZE			(SLOT_AREA-MOD_AREA)
+#define SLOT_MAXSIZE		(BANK_VHAREA-SLOT_AREA)
+#define PREFETCH_FRAMES		30			// Frames the cursor has to rest on an entry
+#define PLAYLIST_MAX		32			// Entries that can be queued
+#define PLAYLIST_SCAN		64			// Entries looked through for the next music
+#define EXE_CHUNK			64			// Sectors per EXE body read
+#define LOAD_RESIDENT		-1			// Load handle of data read by a blocking loader
+
+// SEQ packs are read file by file, only what the selected track needs
+#define PACK_MAXFILES		85			// QLP entries that fit the directory sector
+#define PACK_MAXPARTS		8
+#define PACK_MERGEGAP		4			// Sectors worth reading through instead of seeking
+#define VH_MAGIC			0x56414270	// "pBAV", how a VH starts
+
+// Ring buffer for packs whose VB is streamed to SPU RAM instead of being
+// loaded along with the rest of the pack
+#define VBSTREAM_SECTORS	8			// Sectors per half
+#define VBSTREAM_AREA		(0x801B2000-(VBSTREAM_SECTORS*2048*2))
+
+// VABs are kept in SPU RAM after their music stops, so packs sharing a bank
+// (songs of one soundtrack) only open their SEQ. libsnd reads the VH while
+// playing, so a copy of each is kept below the VB ring buffer.
+#define BANK_MAX			4			// VABs kept resident
+#define BANK_VHSIZE			(1024*64)
+#define BANK_VHAREA			(VBSTREAM_AREA-BANK_VHSIZE)
+#define BANK_VBHASH			4096		// Bytes of the VB that go into its key
+
+// SPU RAM is laid out by the menu, VBs and VAGs are placed from a map of
+// it and the reverb work area is sized for the mode in use, at the top
+#define SRAM_START			0x1010		// Below are the capture buffers
+#define SRAM_END			0x80000
+#define SRAM_ALIGN			16
+#define SRAM_BLOCKS			32
+#define SRAM_REVMODES		10			// SPU_REV_MODE_OFF to SPU_REV_MODE_PIPE
+#define SRAM_FREE			0
+#define SRAM_VAB			1
+#define SRAM_VAG			2
+#define SRAM_REVERB			3
 
 #define TITLE_AREA			0x8003000C
-#define CONT_AREA			0x80030800
+
+// XA sampling, the TOC and sector headers go in what is left between the
+// menu and MOD_AREA, so no music data is overwritten by them
+#define CD_SCRATCH			(MENU_AREA+MENU_SIZE)
+#define XA_SAMPLESECTORS	6			// XASECTORs that fit CD_SCRATCH
+
+// Only a small index of the menu is kept for every entry, the entries
+// themselves are decoded a page at a time around the cursor and decoded
+// again from the list file when they come back into view
+#define TITLE_PAGESIZE		16			// Entries per page
+#define TITLE_PAGES			16			// Pages kept decoded
+#define TITLE_SECTORS		2			// List file sectors buffered for decoding
+#define INDEX_AREA			MENU_AREA
+#define PAGE_AREA			(INDEX_AREA+(MAX_TITLES*8))
+#define PAGEREAD_AREA		(PAGE_AREA+(TITLE_PAGES*TITLE_PAGESIZE*sizeof(TITLESTRUCT)))
+#define PATH_AREA			(PAGEREAD_AREA+(TITLE_SECTORS*2048))
+
+// The paths of the decoded entries are kept once each, entries only hold an
+// ID so comparing them is cheap
+#define TITLEPATH_MAX		256
+#define TITLEPATH_TEXT		8192		// Bytes for all the paths
+
+// Menus visited (or read ahead) are kept in the part of the title index the
+// current menu doesn't use, so going back to one needs no CD reads
+#define MENUCACHE_MAX		16
+#define MENUCACHE_MAXFILE	(LISTFILE_CHUNK*2*2048)	// Biggest list file kept
+#define MENUCACHE_SIZE		(MAX_TITLES*8)
+#define MENU_SCRATCH		VBSTREAM_AREA	// Cached lists are parsed from here
+#define MENU_STAGE			MENU_SCRATCH	// and new ones read to, the music keeps playing
+#define MENU_STAGESIZE		(VBSTREAM_SECTORS*2*2048)
+#define NAV_DEPTH			16
+
+// Entries are searched by the first characters of their names, packed above
+// the entry number so the keys sort in name order
+#define TITLEKEY_CHARS		3
+#define TITLEKEY_BITS		6			// Per character, upper case and symbols
+#define TITLEKEY_CODES		(1<<TITLEKEY_BITS)
+#define TITLEKEY_SHIFT		14			// Room for MAX_TITLES
+#define TITLEKEY_ENTRY		((1<<TITLEKEY_SHIFT)-1)
+
+#define TITLESRC_TXT		0
+#define TITLESRC_BIN		1
+#define TITLESRC_VFS		2
 
 // Cosmetic stuff
 #define MAX_BUBBLES	64
@@ -117,6 +206,23 @@
 #define MENU_VFS 0xFFFFFFFE
 #define MENU_TXT 0xFFFFFFFF
 
+// Interleave of an XA file worked out when its VFS was made
+#define XAINFO_KNOWN	0x80
+#define XAINFO_2X		0x40	// Needs double speed
+#define XAINFO_CHANS	0x1F	// Highest channel
+
+// What picking an entry does, worked out from its stack address when it is
+// decoded. Each kind has a handler in PickPlay[] and PickReload[].
+#define KIND_EXE		0	// Anything else is an EXE
+#define KIND_SEP		1	// Track of a SEP, Sub is the track
+#define KIND_SEQ		2	// Track of a multitrack SEQ, Sub is the track
+#define KIND_XA			3	// XA channel, Sub is the channel
+#define KIND_LOAD		4	// Music read in the background
+#define KIND_SEQLOAD	5	// Single SEQ, also read in the background
+#define KIND_MENU		6	// TXT and VFS submenus
+#define KIND_PLAY		7	// Played right away, no music, CD audio and XA files
+#define KIND_COUNT		8
+
 
 // Ordering tables and packet buffers for the graphics system
 GsOT 		myOT[2];
@@ -192,12 +298,265 @@ typedef struct {
 // Struct to store title names and executable paths
 typedef struct {
 	char	Name[64];
-	char	ExecFile[52];
+	u_short	Path;			// Executable path, see PathName()
 	u_long	StackAddr;
 	int 	SectorStart;
 	int 	SectorLength;
+	u_char	Kind;			// KIND_*, see TitleKind()
+	u_char	Xa;				// XAINFO_* from a VFS v2, 0 if the XA has to be sampled
+	u_short	Sub;			// Track or channel within the file
 } TITLESTRUCT;
 
+// What is kept of every entry in the menu
+typedef struct {
+	u_long	Offset;		// Where the entry starts in the list file
+	u_long	StackAddr;	// Also holds changes made from the menu
+} TITLEINDEX;
+
+// List file the current menu was read from, pages are decoded from it
+typedef struct {
+	int		Kind;		// TITLESRC_TXT, TITLESRC_BIN or TITLESRC_VFS
+	char	File[56];
+	u_long	Ssect;
+	int		Lba;		// First sector of the list, -1 if it can't be read
+	u_long	Size;
+	u_long	Strings;	// Offset of the string table of compiled lists
+	u_long	Record;		// Size of a VFS entry, tells the versions apart
+	int		Sector[TITLE_SECTORS];	// Sectors in the buffer, -1 if none
+	int		Next;		// Buffer the next sector goes to
+} TITLESOURCE;
+
+// Compiled title list (TITLES.BIN, made with TOOLS/mktitles.c). The entries
+// follow the header and the strings they point to follow the entries.
+typedef struct {
+	char	Magic[4];		// "TBIN"
+	u_long	Version;		// TITLESBIN_VERSION
+	u_long	Count;
+	u_long	Strings;		// Size of the string table
+} TITLESBIN;
+
+typedef struct {
+	u_long	StackAddr;
+	u_long	Name;			// Offsets into the string table
+	u_long	ExecFile;
+	int		SectorStart;
+	int		SectorLength;
+} TITLESBINENTRY;
+
+#define TITLESBIN_VERSION	1
+
+// State of the TITLES.TXT parser between chunks
+typedef struct {
+	int		InQuote;
+	int		GrabStep;		// Field being grabbed: name, file, stack address
+	int		CharNum;
+	int		TitleNum;
+	char	AddrText[16];
+	u_long	Pos;			// Offset of the chunk in the file
+	u_long	Start;			// Offset of the entry being grabbed
+	int		Last;			// Entry to stop at
+	int		Refill;			// Decoding a page, the index is already built
+	TITLESTRUCT	Cur;
+	char	File[52];
+} TITLEPARSE;
+
+// Directory entry of a VFS pack
+typedef struct {
+	char	name[64];
+	u_long	size;
+	u_long	addr;
+	u_long	sector_size;
+	u_long	byte_addr;
+	u_long	stack;
+} VFSFILE;
+
+// Header of a VFS v2 pack (made with TOOLS/mkvfs.c). v1 has the entry count
+// and directory sectors in the same place but no magic, and its entries
+// start right after them.
+typedef struct {
+	char	Magic[4];		// "VFS2"
+	u_long	Count;
+	u_long	Sectors;		// Of the directory, header included
+	u_long	Version;		// VFS_VERSION
+	u_long	Lba;			// Where the pack is on the disc, 0 until patched
+	u_long	Size;			// Of the whole pack
+} VFSHEAD;
+
+// Directory entry of a VFS v2 pack
+typedef struct {
+	char	name[64];
+	u_long	size;
+	u_long	addr;			// First sector, within the pack
+	u_long	sector_size;
+	u_long	lba;			// First sector on the disc, 0 until patched
+	u_long	stack;			// Only for EXEs
+	u_long	type;			// MUSIC_*, MENU_*, SEP_MIN/SEQ_MIN/XA_MIN, or 0 for an EXE
+	u_short	sub;			// Track or channel for SEP_MIN/SEQ_MIN/XA_MIN
+	u_char	xa;				// XAINFO_*
+	u_char	pad;
+} VFSFILE2;
+
+#define VFS_VERSION		2
+
+// Background load started from the menu
+typedef struct {
+	int		Handle;		// CdAsyncRead() handle, 0 when nothing is loading
+	int		Title;		// Entry being loaded
+	int		PadStatus;	// Pad state when the entry was selected
+	int		Stage;		// Read stage of multi-read loads (VFS)
+	u_long	Type;		// Music system left initialised by the previous entry
+	int		Ready;		// Data is already in memory, just open it
+	int		Slot;		// Load slot being filled, -1 for submenus
+	u_long*	Buff;		// Where a submenu list is read to
+} LOADSTRUCT;
+
+// Music backend, one per MUSIC_* type. Functions left 0 have nothing to do
+// for that backend. Open() starts the music loaded to MusArea, or the file
+// itself for music played from the disc.
+typedef struct {
+	u_long	Type;
+	void	(*Init)();
+	void	(*Quit)();
+	int		(*Open)(TITLESTRUCT* file, int PadStatus);
+	void	(*Stop)();
+	void	(*Play)();
+	void	(*Pause)();
+	void	(*Track)(short track);
+	void	(*Vol)(short left, short right);
+	void	(*RVol)(short left, short right);
+	void	(*RevMode)(short mode);
+	void	(*RDepth)(short left, short right);
+	void	(*Delay)(short delay);
+	void	(*Feedback)(short feedback);
+	int		(*Ended)();		// True once the music has played out
+} MUSICDRIVER;
+
+// Where the sound system is at, so the music functions only do what is
+// still needed
+#define MUSSTATE_OFF		0	// Nothing set up
+#define MUSSTATE_READY		1	// Set up for Driver, nothing open
+#define MUSSTATE_OPEN		2	// Music open and playing
+#define MUSSTATE_PAUSED		3	// Music open but paused
+
+#define MUSIC_DRIVERS		8	// MUSIC_NONE to MUSIC_DA
+
+typedef struct {
+	MUSICDRIVER*	Driver;
+	int				State;
+} MUSICSTATE;
+
+// libsnd/libspu session, kept up across music types so switching only has
+// to reconfigure it. Closed before running an EXE or for a MOD, which
+// drives the SPU itself.
+typedef struct {
+	int		Up;			// SpuInit/SsInit done
+	int		Serial;		// CD audio mixed in
+	short	Tick;		// Tick mode libsnd was set to
+} SOUNDSESSION;
+
+// Music load slot
+typedef struct {
+	u_long*	Addr;
+	int		Size;
+	int		Handle;		// CdAsyncRead() handle of the read filling the slot
+	int		Ready;		// Slot holds the whole entry
+	int		Bytes;
+	char	File[52];	// Entry in the slot, matched by file and sector range
+	int		SectorStart;
+	int		SectorLength;
+	int		Seq;		// Track a partly read pack was read for
+	int		Files;		// Files in a partly read pack, -1 before its directory is in
+	u_char	Have[PACK_MAXFILES];
+	int		Part;		// Sector ranges of the pack still to be read
+	int		Parts;
+	int		PartStart[PACK_MAXPARTS];
+	int		PartLength[PACK_MAXPARTS];
+} SLOTSTRUCT;
+
+// VB left on the disc by SlotLoadHead()
+typedef struct {
+	u_long*	Pack;		// Pack it belongs to, 0 if none
+	int		Vb;			// QLP entry of the VB
+	int		Lba;		// First sector of the VB
+	int		Skip;		// Offset of the VB in that sector
+	u_long	Size;
+} VBSTREAM;
+
+// A VAB kept in SPU RAM
+typedef struct {
+	short	Vab;		// libsnd VAB ID, -1 for a free entry
+	short	Refs;		// SEQ/SEP open on it
+	u_long	Key;		// Hash of the VH and the VB size
+	u_char*	Vh;			// Copy in BANK_VHAREA, or the pack's own if not Kept
+	u_long	VhSize;
+	u_long	VbSize;
+	u_long	Spu;		// Where the VB is in SPU RAM
+	u_long	Used;		// Banks.Stamp when last opened
+	int		Kept;		// Stays open when its music stops
+} BANKENTRY;
+
+typedef struct {
+	BANKENTRY	Bank[BANK_MAX];
+	u_long		Stamp;
+} BANKCACHE;
+
+// Part of SPU RAM, the blocks of the map are in address order and cover
+// SRAM_START to SRAM_END. The reverb work area is always the last one.
+typedef struct {
+	u_long	Addr;
+	u_long	Size;
+	int		Kind;		// SRAM_*
+} SRAMBLOCK;
+
+typedef struct {
+	SRAMBLOCK	Block[SRAM_BLOCKS];
+	int			Blocks;
+	short		RevMode;	// Mode the reverb work area is sized for
+} SRAMMAP;
+
+// Speculative read of the entry under the cursor
+typedef struct {
+	int		Hover;		// Entry under the cursor and how long it has been there
+	int		Frames;
+} PREFETCHSTRUCT;
+
+// Entries played one after the other, the queued ones first and then the
+// music entries of the menu following the one playing
+typedef struct {
+	int		On;
+	int		Current;	// Entry playing, -1 if none of this menu
+	int		Frames;		// Since it was picked, the end isn't looked for at first
+	int		Queue[PLAYLIST_MAX];
+	int		Head;
+	int		Count;
+} PLAYLIST;
+
+// List file of a menu, also a menu to go back to
+typedef struct {
+	char	File[56];
+	int		Kind;		// TITLESRC_VFS, or TITLESRC_TXT for both text and compiled
+	u_long	Ssect;
+	u_long	Nsect;
+	int		Lba;		// First sector of the list, tells menus apart
+	int		Size;
+	int		SelTitle;
+} MENULIST;
+
+// List file kept in the menu cache
+typedef struct {
+	MENULIST	List;
+	int			Offset;		// From INDEX_AREA
+	int			Bytes;		// 0 if the list is too big to keep
+	int			Used;		// 0 for lists only read ahead
+} MENUCACHE;
+
+// Read ahead of the submenus in the current menu
+typedef struct {
+	int			Handle;
+	int			Next;		// Entry to look at next
+	MENULIST	List;
+} MENUPREFETCH;
+
 typedef struct {
 	u_char sector[3];
 	u_char mode;
@@ -213,16 +572,66 @@ typedef struct {
 	int DUMMY;
 } XASECTOR;
 
-//TITLESTRUCT Title[MAX_TITLES]={0};
-TITLESTRUCT* Title=(TITLESTRUCT*)MENU_AREA;
+TITLEINDEX*		TitleIndex=(TITLEINDEX*)INDEX_AREA;
+TITLESTRUCT*	TitleData=(TITLESTRUCT*)PAGE_AREA;
+int				TitlePage[TITLE_PAGES];		// First entry of each page, -1 if unused
+TITLESOURCE		TitleSrc={0};
+TITLESTRUCT		TitleNone={"", 0, MUSIC_NONE, 0, 0, KIND_PLAY};
+int				TitleLast=0;	// Page handed out last
+u_char			TitleDaSet[(MAX_TITLES+7)/8];	// Entries set to CD audio from the menu
+
+char*			PathText=(char*)PATH_AREA;
+u_short			PathOffset[TITLEPATH_MAX];
+u_long			PathKey[TITLEPATH_MAX];		// CdIndexHash() of each path
+int				PathCount=0;
+int				PathSize=0;
 
 int		NumTitles=0;
+char	TitlesBinName[56]={0};
 int 	SelTitle=0;
 char	StringBuff[56]={0};
 char	NameBuff[64]={0};
 
 int		LSMI=MAX_TITLES + 1;
 
+LOADSTRUCT		Load={0};
+PREFETCHSTRUCT	Pf={0};
+PLAYLIST		Playlist={ false, -1 };
+int				XaEnd=false;		// The XA channel playing reached its end
+int				DaList[2]={0};		// Track played by CdPlay(), which keeps the list
+
+MENUCACHE		MenuCache[MENUCACHE_MAX];
+int				MenuCacheCount=0;
+int				MenuCacheLow=MENUCACHE_SIZE;	// Bottom of the lists kept
+int				MenuCacheClock=0;
+MENUPREFETCH	MenuPf={0};
+MENULIST		Nav[NAV_DEPTH];
+int				NavDepth=0;
+
+u_long			TitleKey[MAX_TITLES];		// Collected as the menu loads
+int				TitleKeys=0;
+int				TitleSorted=false;
+int				TitleFirst[TITLEKEY_CODES+1];	// First key of each first character
+u_char			FilterCode[TITLEKEY_CHARS];
+int				FilterLen=0;
+char			FilterBuff[TITLEKEY_CHARS+1];
+int				ViewStart=0;	// Keys shown while filtering, and the cursor among them
+int				ViewEnd=0;
+int				ViewPos=0;
+SLOTSTRUCT		Slot[2]={
+	{ (u_long*)MOD_AREA, MOD_MAXSIZE },
+	{ (u_long*)SLOT_AREA, SLOT_MAXSIZE }
+};
+VBSTREAM		VbStream={0};
+BANKCACHE		Banks={ { {-1}, {-1}, {-1}, {-1} } };
+SRAMMAP			Sram;
+// Bytes of reverb work area by mode
+u_long			SramRevSize[SRAM_REVMODES]={
+	0x10, 0x26C0, 0x1F40, 0x4840, 0x6FE0, 0xADE0, 0xF6C0, 0x18040, 0x18040, 0x3C00
+};
+int				MusSlot=0;
+u_long*			MusArea=(u_long*)MOD_AREA;	// Slot the current music plays from
+
 PARAMS_V1 p;
 //short vol = 127;
 u_long vag1;
@@ -234,24 +643,105 @@ short curtrk;
 
 //char seq_table[SS_SEQ_TABSIZ * 4 * 5];
 char seq_table[SS_SEQ_TABSIZ * 1 * 16];
-char spu_malloc_rec [SPU_MALLOC_RECSIZ * (MALLOC_MAX + 3)];
 
 // For launching an EXE
 struct EXEC ExeParams;
 
+// EXE body read in chunks while the menu fades out. Parts of the body that
+// land on Title[] are held back until the menu no longer needs the list.
+typedef struct {
+	int				Started;
+	int				Error;
+	u_long			Stack;			// Title[] may be gone by the time the stack is set
+	int				Lba;			// First sector of the body
+	u_char*			Dest;
+	int				Start[3];		// Body sector ranges in read order, the last
+	int				End[3];			// one overlaps Title[]
+	int				Range;
+	int				Next;			// Next sector of the current range
+	int				Last;			// First sector of the chunk in flight
+	int				Guarded;		// Title[] still in use
+	volatile int	Busy;			// Chunk in flight, cleared by ExeReady()
+} EXELOAD;
+
+EXELOAD Exe={0};
+
 PARAMS_HEADER ParamsNull;
 
 // Function prototypes
 int main();
 void DoMenu();
 int LoadEXEfile(char *FileName, struct EXEC *params,  u_long ssect, u_long nsect);
+int ExePoll();
+void ExeReady(u_char intr, u_char *result);
 
 void fPrint(char *string, short x, short y, char opacity, GsOT *otptr, GsIMAGE font);
 void SortBigImage (int x, int y, GsIMAGE TimImage);
 
 void Init();
 void LoadGraphics(char* gfxfile, u_long ssect, u_long nsect);
+void OpenGraphics(u_long* addr);
 void InitTitles(char* titlefile, u_long ssect, u_long nsect);
+void ParseTitles(char* TextBuff, int b);
+void ParseTitlesStart(TITLEPARSE* tp);
+int ParseTitlesChunk(TITLEPARSE* tp, char* TextBuff, int b);
+void ParseTitlesEnd(TITLEPARSE* tp);
+int ParseTitlesBin(char* buff, int b);
+char* TitlesFile(char* titlefile);
+int TitlesBin(char* titlefile);
+void IndexTitles();
+
+void TitleSource(char* file, u_long ssect);
+TITLESTRUCT* TitleAt(int title);
+TITLESTRUCT* TitlePeek(int title);
+int TitleFind(int title);
+int TitleVictim(int first);
+void TitleStore(int title, TITLESTRUCT* entry, char* path);
+void TitleFill(int first, int page);
+void TitleRefill();
+char* TitleSrcSector(int sect);
+int TitleSrcCopy(char* dest, u_long offset, int len);
+void VfsEntry(TITLESTRUCT* entry, VFSFILE* file);
+void VfsEntry2(TITLESTRUCT* entry, VFSFILE2* file);
+
+void TitleRoom(int title);
+
+int MenuList(TITLESTRUCT* entry, MENULIST* list);
+void MenuListSrc(MENULIST* list);
+int MenuListSlot(MENULIST* list);
+int MenuCacheFind(int lba);
+int MenuCacheOldest();
+void MenuCacheDrop(int i);
+int MenuCacheRoom(int bytes);
+void MenuCacheAdd(MENULIST* list, char* buff, int bytes, int used);
+void MenuCacheKeep(char* buff, int bytes);
+void MenuLeave();
+int MenuOpen(int lba);
+int MenuEnter(TITLESTRUCT* entry);
+int MenuBack(int disc);
+u_long MenuReturn(u_long MusType);
+void NavPush();
+void MenuPrefetch(int start);
+
+u_long TitleKeyName(char* name);
+int TitleKeyCode(u_long key, int pos);
+void TitleSortKeys();
+int TitleKeyBound(u_long prefix);
+void TitleJump(int dir);
+u_long FilterPrefix(int len);
+void FilterView();
+int FilterAdd();
+int FilterStep(int dir);
+void FilterBack();
+char* FilterName();
+int ViewCount();
+int ViewEntry(int pos);
+void ViewSelect(int pos);
+
+void PathClear();
+u_short PathId(char* path);
+char* PathName(int id);
+void PathCompact();
 
 float frand();
 int hex2int(char *string);
@@ -264,10 +754,40 @@ void Display();
 void DisplayNoClear();
 
 u_long StartMusic (TITLESTRUCT* file, u_long currenttype, int PadStatus);
+void MusicUse (u_long filetype, u_long currenttype);
+MUSICDRIVER* MusicDriver (u_long filetype);
 int StopMusic (u_long filetype);
 int UnloadMusic (u_long filetype);
 int LoadMusic (u_long filetype);
 int ChangeMusic (TITLESTRUCT* file, int PadStatus);
+int OpenMusic (TITLESTRUCT* file, int PadStatus);
+int MusicNeedsData (u_long filetype);
+
+u_long BeginLoad (int title, int PadStatus, u_long MusType);
+int LoadStatus ();
+int FinishLoad (u_long *MusType);
+void CancelLoad ();
+
+void Prefetch (int title, u_long MusType);
+int PlaylistMusic (TITLESTRUCT* entry);
+int PlaylistNext (int take);
+void PlaylistQueue (int title);
+void PlaylistClear ();
+int MusicEnded (u_long filetype);
+int EntryBytes (TITLESTRUCT* file);
+int IsPack (u_long filetype);
+int SlotRead (int slot, int title);
+int SlotLoad (int slot, TITLESTRUCT* file);
+int SlotLoadHead (int slot, TITLESTRUCT* file);
+int PackVb (u_long* addr, TITLESTRUCT* file);
+u_long PackMagic (u_long* addr, TITLESTRUCT* file, int filenum);
+int SlotPoll (int slot);
+int SlotPlan (int slot);
+int SlotNextPart (int slot);
+void PackNeed (u_long* addr, int filenum);
+void SlotDrop (int slot);
+void SlotUse (int slot);
+int SlotHas (int slot, int title);
 
 int PlayMusic (u_long filetype);
 int PauseMusic (u_long filetype);
@@ -276,11 +796,33 @@ short ChangeTrack (short nowtrack, u_long filetype);
 short ChangeVol (short nowvolL, short nowvolR, u_long filetype);
 
 void InitVfs(char* vfsfile);
+char* MenuStage(int bytes);
+void ParseVfs(char* vfsfile, u_long* dir);
 int CDRF(char* file, u_long *addr, u_long startsect, u_long nsect);
 int LoadSep (char* name, u_long* addr, u_long ssect, u_long nsect, short ptrack);
-short LoadSeq (u_long* addr, short ptrack, int extfiles);
+int OpenSep (u_long* addr, short ptrack);
+short TransVab (u_long* addr, int vbnum, short vab);
+short StreamVab (short vab);
+u_long BankKey (u_char* vh, u_long vhsize, u_char* vb, u_long vbsize);
+short BankOpen (u_long* addr, int vhnum, int vbnum);
+void BankRelease (short vab);
+int BankEvict ();
+int BankDropAt (u_long spu);
+void BankFlush ();
+u_char* BankPlace (u_long size);
+void SramInit ();
+u_long SramAlloc (u_long size, int kind);
+void SramFree (u_long addr);
+int SramReverb (short mode);
+void SramReverbClear ();
+void SramDump ();
+short LoadSeq (u_long* addr, short ptrack);
 PARAMS_V1 ParamsV1ToDefault();
 int CDReverbEnable();
+void SoundOpen();
+void SoundClose();
+void SoundTick(short mode);
+void SoundSerial(int on);
 
 int SeqParamCount (u_long* addr);
 short LoadPreParams(PARAMS_HEADER* addr);
@@ -300,8 +842,133 @@ short ChangeRDepth (short nowvolL, short nowvolR, u_long filetype);
 short ChangeDelay (short nowfbdel, u_long filetype);
 short ChangeFeedback (short nowfbdel, u_long filetype);
 
+void SndInit();
+void SndQuit();
+void SndRVol(short left, short right);
+void SndRevMode(short mode);
+void SndRDepth(short left, short right);
+void SndDelay(short delay);
+void SndFeedback(short feedback);
+void SerialVol(short left, short right);
+void DiscPause();
+
+void ModInit();
+int ModOpen(TITLESTRUCT* file, int PadStatus);
+void ModStop();
+void ModPlay();
+void ModPause();
+
+int SeqOpen(TITLESTRUCT* file, int PadStatus);
+void SeqStop();
+void SeqPlay();
+void SeqPause();
+void SeqTrack(short track);
+void SeqVol(short left, short right);
+
+int SeqEnded();
+
+int SepOpen(TITLESTRUCT* file, int PadStatus);
+void SepStop();
+void SepPlay();
+void SepPause();
+void SepTrack(short track);
+void SepVol(short left, short right);
+int SepEnded();
+
+void VagInit();
+void VagQuit();
+int VagOpen(TITLESTRUCT* file, int PadStatus);
+void VagStop();
+void VagVol(short left, short right);
+void VagRevMode(short mode);
+void VagRDepth(short left, short right);
+void VagDelay(short delay);
+void VagFeedback(short feedback);
+
+void DaInit();
+void DaQuit();
+int DaOpen(TITLESTRUCT* file, int PadStatus);
+void DaStop();
+void DaPlay();
+void DaTrack(short track);
+int DaEnded();
+
+void XaInit();
+void XaQuit();
+int XaOpen(TITLESTRUCT* file, int PadStatus);
+void XaPlay();
+void XaTrack(short track);
+int XaEnded();
+
+MUSICDRIVER MusicNone={ MUSIC_NONE };
+MUSICDRIVER MusicMod={
+	MUSIC_MOD, ModInit, 0, ModOpen, ModStop, ModPlay, ModPause
+};
+MUSICDRIVER MusicSeq={
+	MUSIC_SEQ, SndInit, SndQuit, SeqOpen, SeqStop, SeqPlay, SeqPause, SeqTrack,
+	SeqVol, SndRVol, SndRevMode, SndRDepth, SndDelay, SndFeedback, SeqEnded
+};
+MUSICDRIVER MusicSep={
+	MUSIC_SEP, SndInit, SndQuit, SepOpen, SepStop, SepPlay, SepPause, SepTrack,
+	SepVol, SndRVol, SndRevMode, SndRDepth, SndDelay, SndFeedback, SepEnded
+};
+MUSICDRIVER MusicVag={
+	MUSIC_VAG, VagInit, VagQuit, VagOpen, VagStop, 0, 0, 0,
+	VagVol, 0, VagRevMode, VagRDepth, VagDelay, VagFeedback
+};
+MUSICDRIVER MusicXa={
+	MUSIC_XA, XaInit, XaQuit, XaOpen, DiscPause, XaPlay, DiscPause, XaTrack,
+	SerialVol, SndRVol, SndRevMode, SndRDepth, SndDelay, SndFeedback, XaEnded
+};
+MUSICDRIVER MusicDa={
+	MUSIC_DA, DaInit, DaQuit, DaOpen, DaStop, DaPlay, DiscPause, DaTrack,
+	SerialVol, SndRVol, SndRevMode, SndRDepth, SndDelay, SndFeedback, DaEnded
+};
+
+// By MUSIC_* type, from MUSIC_NONE on
+MUSICDRIVER* MusicDrivers[MUSIC_DRIVERS]={
+	&MusicNone, &MusicMod, &MusicNone, &MusicSeq, &MusicSep, &MusicVag, &MusicXa, &MusicDa
+};
+
+MUSICSTATE Music={ &MusicNone, MUSSTATE_OFF };
+SOUNDSESSION Sound={ false, false, 0 };
+
+void TitleKind(TITLESTRUCT* entry);
+int TitleSame(int title, int other);
+
+// What picking an entry needs from DoMenu, and what it changes there
+typedef struct {
+	int		Title;
+	int		PadStatus;
+	u_long	MusType;
+	int		MusPlaying;
+	int		Timeout;		// Restart the reverb timeout
+	int		Chosen;			// An EXE was picked
+} PICKSTRUCT;
+
+typedef void (*PICKFUNC)(PICKSTRUCT* pick);
+
+void PickExe(PICKSTRUCT* pick);
+void PickSep(PICKSTRUCT* pick);
+void PickSeq(PICKSTRUCT* pick);
+void PickXa(PICKSTRUCT* pick);
+void PickLoad(PICKSTRUCT* pick);
+void PickMusic(PICKSTRUCT* pick);
+void PickParams(PICKSTRUCT* pick);
+void PickPostParams(PICKSTRUCT* pick, PARAMS_HEADER* ParamPtr);
+
+// Cross on its own, by kind
+PICKFUNC PickPlay[KIND_COUNT]={
+	PickExe, PickSep, PickSeq, PickXa, PickLoad, PickLoad, PickLoad, PickMusic
+};
+
+// Triangle+Cross, only SEQs have anything to do
+PICKFUNC PickReload[KIND_COUNT]={
+	0, 0, PickParams, 0, 0, PickParams, 0, 0
+};
+
 void cbready(int intr, u_char *result);
-short LoadXA (char* name, short ptrack, int trackswitch);
+short LoadXA (char* name, int ssect, short ptrack, int trackswitch, u_char xa);
 char XASpeed(CdlLOC fp, XASECTOR* buf, int sect, u_char file, u_char channel);
 
 CdlCB Oldcallback;
@@ -312,6 +979,18 @@ char cdspeed;
 // Include my custom little libraries
 #include "timlib.c"
 #include "qlplib.c"
+#include "cdlib.c"
+
+// Roles of the files in the SEQ pack of a slot, worked out once per pack
+typedef struct {
+	QLPVIEW	View;		// View.base is 0 if not worked out or not a SEQ pack
+	int		Vh;			// QLP entry of the VH, the VB follows it
+	int		Params;		// Parameter files after the VB
+} SEQPACK;
+
+SEQPACK			SeqPack={0};
+
+SEQPACK* SeqView (u_long* addr);
 
 
 int main() {
@@ -324,25 +1003,34 @@ int main() {
 	
 
 	// Set stack
-	if (Title[SelTitle].StackAddr != MUSIC_NEWEXE && Title[SelTitle].StackAddr != MUSIC_ZEROEXE)
+	if (Exe.Stack != MUSIC_NEWEXE && Exe.Stack != MUSIC_ZEROEXE)
 	{
-		ExeParams.s_addr = Title[SelTitle].StackAddr;
+		ExeParams.s_addr = Exe.Stack;
 	}
-	if (Title[SelTitle].StackAddr != MUSIC_NEWEXE)
+	if (Exe.Stack != MUSIC_NEWEXE)
 	{
 		ExeParams.s_size = 0;
 	}
 	// Clear the entire framebuffer to avoid possible graphical glitches
 	ClearImage2(&ClearRect, 0, 0, 0);
-	DrawSync(0);
 	
 	#if DEBUG
 	printf("Stack set to: %X\n", (u_long)ExeParams.s_addr);
 	printf("Execute!\n");
 	#endif
 	
-	// Terminate a bunch of things then execute the loaded EXE
-	SpuQuit();
+	// Terminate a bunch of things while the last chunks of the EXE come in
+	SoundClose();
+	DrawSync(0);
+	while (ExePoll() == false);
+	#if DEBUG
+	printf("EXE loaded successfully.\n");
+	#endif
+	#if CDTRACE
+	CdTraceDump();
+	#endif
+	
+	// Then execute the loaded EXE
 	ResetGraph(3);
 	PadStop();
 	StopCallback();
@@ -356,6 +1044,7 @@ void DoMenu() {
 	
 	int		i=0,rnum=0,ba=0;
 	int		ListDrawY=0,ItemY=0;
+	char*	ItemName=0;
 	int		StartListY=0,EndListY=0,MaxListLength=0;
 	
 	int		fBannerY=0;
@@ -364,6 +1053,8 @@ void DoMenu() {
 	int		TransState=0;
 	
 	int		PadStatus=0;
+	int		SelPos=0;
+	int		SelectUsed=false;
 
 	int		Timeout=0;
 	int		TimeoutStart=10;
@@ -376,8 +1067,16 @@ void DoMenu() {
 	u_long  MusType=MUSIC_NONE;
 	int    MusPlaying=false;
 	
+	char	LoadText[24]={0};
+	#if CDTRACE
+	int		TraceSeeks=0;
+	#endif
+	short	RevNext=0;
+	
 	
 	PARAMS_HEADER* ParamPtr = 0;
+	PICKSTRUCT	Pick;
+	PICKFUNC	PickFunc;
 	
 	typedef struct {
 		int	x,y;
@@ -436,6 +1135,25 @@ void DoMenu() {
 		}
 		PrepDisplay();
 		PadStatus = PadRead(0);
+		
+		// Finish a background load once its data has landed
+		if (Load.Handle) {
+			switch (LoadStatus()) {
+				case CDASYNC_BUSY:
+					break;
+				case CDASYNC_DONE:
+					if (FinishLoad(&MusType)) Timeout = TimeoutStart;
+					MusPlaying = (MusType != MUSIC_NONE);
+					Playlist.Frames = 0;
+					break;
+				default:
+					#if DEBUG
+					printf("Background load of %s failed\n", PathName(TitleAt(Load.Title)->Path));
+					#endif
+					CancelLoad();
+					break;
+			}
+		}
 
 		// Title selection controls
 		if (TitleChosen == false) {
@@ -443,186 +1161,191 @@ void DoMenu() {
 			//printf("PAD %i\n",PadStatus);
 			//select nothing
 			if (PadStatus == 0 || PadStatus == PADRleft || PadStatus == PADRup || PadStatus == (PADRup | PADRleft)) {
+				if ((padPressed == PADselect) && (SelectUsed == false)) {
+					CancelLoad();
+					UnloadMusic(MusType);
+					LSMI = MAX_TITLES + 1;
+					MusType = MUSIC_NONE;
+				}
 				padPressed = 0;
 				padPressedCount = 0;
 			}
 			if (PadStatus & (PADRup | PADRleft))
 			{
 				if (PadStatus & PADLup) {
-					if (Title[SelTitle].StackAddr < 0xFFFFFFFF) {
+					if (TitleAt(SelTitle)->StackAddr < 0xFFFFFFFF) {
 						if (padPressed != PADLup + PADRup + PADRleft) {	
-						Title[SelTitle].StackAddr++;
+						TitleAt(SelTitle)->StackAddr++;
 						padPressedCount = 0;
 						}
 						if (padPressedCount >= 32)	padPressedCount = 30;
-						if (padPressedCount == 30)	Title[SelTitle].StackAddr++;
+						if (padPressedCount == 30)	TitleAt(SelTitle)->StackAddr++;
 						padPressedCount += 1;
 					}
 					padPressed = PADLup + PADRup + PADRleft;
 					#if DEBUG
-					printf("StackAddr for title %i (%s) is %X\n", SelTitle, Title[SelTitle].ExecFile, Title[SelTitle].StackAddr);
+					printf("StackAddr for title %i (%s) is %X\n", SelTitle, PathName(TitleAt(SelTitle)->Path), TitleAt(SelTitle)->StackAddr);
 					#endif
 				}
 				if (PadStatus & PADLdown) {
-					if (Title[SelTitle].StackAddr > 0) {
+					if (TitleAt(SelTitle)->StackAddr > 0) {
 						if (padPressed != PADLdown + PADRup + PADRleft) {	
-						Title[SelTitle].StackAddr--;
+						TitleAt(SelTitle)->StackAddr--;
 						padPressedCount = 0;
 						}
 						if (padPressedCount >= 32)	padPressedCount = 30;
-						if (padPressedCount == 30)	Title[SelTitle].StackAddr--;
+						if (padPressedCount == 30)	TitleAt(SelTitle)->StackAddr--;
 						padPressedCount += 1;
 					}
 					padPressed = PADLdown + PADRup + PADRleft;
 					#if DEBUG
-					printf("StackAddr for title %i (%s) is %X\n", SelTitle, Title[SelTitle].ExecFile, Title[SelTitle].StackAddr);
+					printf("StackAddr for title %i (%s) is %X\n", SelTitle, PathName(TitleAt(SelTitle)->Path), TitleAt(SelTitle)->StackAddr);
 					#endif
 				}
 				if (PadStatus & PADLright) {
-					if (Title[SelTitle].StackAddr < 0xFFFFFFF6) {
+					if (TitleAt(SelTitle)->StackAddr < 0xFFFFFFF6) {
 						if (padPressed != PADLright + PADRup + PADRleft) {	
-						Title[SelTitle].StackAddr+=10;
+						TitleAt(SelTitle)->StackAddr+=10;
 						padPressedCount = 0;
 						}
 						if (padPressedCount >= 32)	padPressedCount = 30;
-						if (padPressedCount == 30)	Title[SelTitle].StackAddr+=10;
+						if (padPressedCount == 30)	TitleAt(SelTitle)->StackAddr+=10;
 						padPressedCount += 1;
-					} else if (Title[SelTitle].StackAddr < 0xFFFFFFFF) {
-						Title[SelTitle].StackAddr = 0xFFFFFFFF;
+					} else if (TitleAt(SelTitle)->StackAddr < 0xFFFFFFFF) {
+						TitleAt(SelTitle)->StackAddr = 0xFFFFFFFF;
 						padPressedCount += 1;
 					}
 					padPressed = PADLright + PADRup + PADRleft;
 					#if DEBUG
-					printf("StackAddr for title %i (%s) is %X\n", SelTitle, Title[SelTitle].ExecFile, Title[SelTitle].StackAddr);
+					printf("StackAddr for title %i (%s) is %X\n", SelTitle, PathName(TitleAt(SelTitle)->Path), TitleAt(SelTitle)->StackAddr);
 					#endif
 				}
 				if (PadStatus & PADLleft) {
-					if (Title[SelTitle].StackAddr > 9) {
+					if (TitleAt(SelTitle)->StackAddr > 9) {
 						if (padPressed != PADLleft + PADRup + PADRleft) {	
-						Title[SelTitle].StackAddr-=10;
+						TitleAt(SelTitle)->StackAddr-=10;
 						padPressedCount = 0;
 						}
 						if (padPressedCount >= 32)	padPressedCount = 30;
-						if (padPressedCount == 30)	Title[SelTitle].StackAddr-=10;
+						if (padPressedCount == 30)	TitleAt(SelTitle)->StackAddr-=10;
 						padPressedCount += 1;
-					} else if (Title[SelTitle].StackAddr > 1) {
-						Title[SelTitle].StackAddr = 0;
+					} else if (TitleAt(SelTitle)->StackAddr > 1) {
+						TitleAt(SelTitle)->StackAddr = 0;
 						padPressedCount += 1;
 					}
 					padPressed = PADLleft + PADRup + PADRleft;
 					#if DEBUG
-					printf("StackAddr for title %i (%s) is %X\n", SelTitle, Title[SelTitle].ExecFile, Title[SelTitle].StackAddr);
+					printf("StackAddr for title %i (%s) is %X\n", SelTitle, PathName(TitleAt(SelTitle)->Path), TitleAt(SelTitle)->StackAddr);
 					#endif
 				}
 				if (PadStatus & PADRdown) {
 					if (padPressed != PADRdown + PADRup + PADRleft) {	
-						Title[SelTitle].StackAddr = MUSIC_NEWEXE;
+						TitleAt(SelTitle)->StackAddr = MUSIC_NEWEXE;
 						padPressedCount = 0;
 					}
 					padPressedCount += 1;
 					padPressed = PADRright + PADRup + PADRleft;
 					#if DEBUG
-					printf("StackAddr for title %i (%s) is %X\n", SelTitle, Title[SelTitle].ExecFile, Title[SelTitle].StackAddr);
+					printf("StackAddr for title %i (%s) is %X\n", SelTitle, PathName(TitleAt(SelTitle)->Path), TitleAt(SelTitle)->StackAddr);
 					#endif
 					TitleChosen = true;
 					TransCount = 0;
-					break;
 				}
 				if (PadStatus & PADRright) {
 					if (padPressed != PADRright + PADRup + PADRleft) {	
-						Title[SelTitle].StackAddr = MUSIC_ZEROEXE;
+						TitleAt(SelTitle)->StackAddr = MUSIC_ZEROEXE;
 						padPressedCount = 0;
 					}
 					padPressedCount += 1;
 					padPressed = PADRright + PADRup + PADRleft;
 					#if DEBUG
-					printf("StackAddr for title %i (%s) is %X\n", SelTitle, Title[SelTitle].ExecFile, Title[SelTitle].StackAddr);
+					printf("StackAddr for title %i (%s) is %X\n", SelTitle, PathName(TitleAt(SelTitle)->Path), TitleAt(SelTitle)->StackAddr);
 					#endif
 					TitleChosen = true;
 					TransCount = 0;
-					break;
 				}
 				if (PadStatus & PADRdown) {
 					if (padPressed != PADRdown + PADRup + PADRleft) {	
-						Title[SelTitle].StackAddr = MUSIC_NEWEXE;
+						TitleAt(SelTitle)->StackAddr = MUSIC_NEWEXE;
 						padPressedCount = 0;
 					}
 					padPressedCount += 1;
 					padPressed = PADRdown + PADRup + PADRleft;
 					#if DEBUG
-					printf("StackAddr for title %i (%s) is %X\n", SelTitle, Title[SelTitle].ExecFile, Title[SelTitle].StackAddr);
+					printf("StackAddr for title %i (%s) is %X\n", SelTitle, PathName(TitleAt(SelTitle)->Path), TitleAt(SelTitle)->StackAddr);
 					#endif
 					TitleChosen = true;
 					TransCount = 0;
-					break;
 				}
 				if (PadStatus & PADselect) {
 					if (padPressed != PADselect + PADRup + PADRleft) {	
-						Title[SelTitle].StackAddr = MUSIC_ZEROEXE;
+						TitleAt(SelTitle)->StackAddr = MUSIC_ZEROEXE;
 						padPressedCount = 0;
 					}
 					padPressedCount += 1;
 					padPressed = PADselect + PADRup + PADRleft;
 					#if DEBUG
-					printf("StackAddr for title %i (%s) is %X\n", SelTitle, Title[SelTitle].ExecFile, Title[SelTitle].StackAddr);
+					printf("StackAddr for title %i (%s) is %X\n", SelTitle, PathName(TitleAt(SelTitle)->Path), TitleAt(SelTitle)->StackAddr);
 					#endif
 				}
 				if (PadStatus & PADstart) {
 					if (padPressed != PADstart + PADRup + PADRleft) {	
-						Title[SelTitle].StackAddr = MUSIC_NEWEXE;
+						TitleAt(SelTitle)->StackAddr = MUSIC_NEWEXE;
 						padPressedCount = 0;
 					}
 					padPressedCount += 1;
 					padPressed = PADstart + PADRup + PADRleft;
 					#if DEBUG
-					printf("StackAddr for title %i (%s) is %X\n", SelTitle, Title[SelTitle].ExecFile, Title[SelTitle].StackAddr);
+					printf("StackAddr for title %i (%s) is %X\n", SelTitle, PathName(TitleAt(SelTitle)->Path), TitleAt(SelTitle)->StackAddr);
 					#endif
 				}
 				if (PadStatus & PADL1) {
 					if (padPressed != PADL1 + PADRup + PADRleft) {	
-						Title[SelTitle].StackAddr = 0x801FFFF0;
+						TitleAt(SelTitle)->StackAddr = 0x801FFFF0;
 						padPressedCount = 0;
 					}
 					padPressedCount += 1;
 					padPressed = PADL1 + PADRup + PADRleft;
 					#if DEBUG
-					printf("StackAddr for title %i (%s) is %X\n", SelTitle, Title[SelTitle].ExecFile, Title[SelTitle].StackAddr);
+					printf("StackAddr for title %i (%s) is %X\n", SelTitle, PathName(TitleAt(SelTitle)->Path), TitleAt(SelTitle)->StackAddr);
 					#endif
 				}
 				if (PadStatus & PADR1) {
 					if (padPressed != PADR1 + PADRup + PADRleft) {	
-						Title[SelTitle].StackAddr = MUSIC_DA;
-						sprintf(Title[SelTitle].ExecFile, "00000002");
+						TitleAt(SelTitle)->StackAddr = MUSIC_DA;
+						TitleAt(SelTitle)->Path = PathId("00000002");
+						TitleDaSet[SelTitle >> 3] |= 1 << (SelTitle & 7);
 						padPressedCount = 0;
 					}
 					padPressedCount += 1;
 					padPressed = PADR1 + PADRup + PADRleft;
 					#if DEBUG
-					printf("StackAddr for title %i (%s) is %X\n", SelTitle, Title[SelTitle].ExecFile, Title[SelTitle].StackAddr);
+					printf("StackAddr for title %i (%s) is %X\n", SelTitle, PathName(TitleAt(SelTitle)->Path), TitleAt(SelTitle)->StackAddr);
 					#endif
 				}
 				if (PadStatus & PADL2) {
 					if (padPressed != PADL2 + PADRup + PADRleft) {	
-						Title[SelTitle].StackAddr = MUSIC_NONE;
+						TitleAt(SelTitle)->StackAddr = MUSIC_NONE;
 						padPressedCount = 0;
 					}
 					padPressedCount += 1;
 					padPressed = PADL2 + PADRup + PADRleft;
 					#if DEBUG
-					printf("StackAddr for title %i (%s) is %X\n", SelTitle, Title[SelTitle].ExecFile, Title[SelTitle].StackAddr);
+					printf("StackAddr for title %i (%s) is %X\n", SelTitle, PathName(TitleAt(SelTitle)->Path), TitleAt(SelTitle)->StackAddr);
 					#endif
 				}
 				if (PadStatus & PADR2) {
 					if (padPressed != PADR2 + PADRup + PADRleft) {	
-						Title[SelTitle].StackAddr = MENU_TXT;
+						TitleAt(SelTitle)->StackAddr = MENU_TXT;
 						padPressedCount = 0;
 					}
 					padPressedCount += 1;
 					padPressed = PADR2 + PADRup + PADRleft;
 					#if DEBUG
-					printf("StackAddr for title %i (%s) is %X\n", SelTitle, Title[SelTitle].ExecFile, Title[SelTitle].StackAddr);
+					printf("StackAddr for title %i (%s) is %X\n", SelTitle, PathName(TitleAt(SelTitle)->Path), TitleAt(SelTitle)->StackAddr);
 					#endif
 				}
+				TitleKind(TitleAt(SelTitle));
 			}
 			// While holding triangle
 			else if (PadStatus & PADRup) {
@@ -680,7 +1403,7 @@ void DoMenu() {
 						ChangeVol(p.VolL, p.VolR, MusType);
 						ChangeFeedback(p.Rfeedback, MusType);
 						ChangeDelay(p.Rdelay, MusType);
-						ChangeRevMode(p.Rmode, MusType);
+						p.Rmode = ChangeRevMode(p.Rmode, MusType);
 						Timeout = TimeoutStart;
 					}
 					padPressedCount += 1;
@@ -763,7 +1486,7 @@ void DoMenu() {
 				#endif
 					if (curtrk < (septrk - 1)) {
 						if (padPressed != PADL1 + PADRup) {
-							ParamPtr = ParamFile((u_long)curtrk - 1, (u_long*)MOD_AREA);
+							ParamPtr = ParamFile((u_long)curtrk - 1, MusArea);
 							if (ParamPtr->Version != 0) {
 								LoadPreParams(ParamPtr);
 							}
@@ -772,7 +1495,7 @@ void DoMenu() {
 								ChangeFeedback(p.Rfeedback, MusType);
 								ChangeDelay(p.Rdelay, MusType);
 								if (LoadPostParams(ParamPtr) > 0) {
-									ChangeRevMode(p.Rmode, MusType);
+									p.Rmode = ChangeRevMode(p.Rmode, MusType);
 									Timeout = TimeoutStart;
 								} else {
 									ChangeRVol(p.RvolL, p.RvolR, MusType);
@@ -794,7 +1517,7 @@ void DoMenu() {
 				#endif
 					if (curtrk > 0) {
 						if (padPressed != PADL1 + PADRup) {
-							ParamPtr = ParamFile((u_long)curtrk - 1, (u_long*)MOD_AREA);
+							ParamPtr = ParamFile((u_long)curtrk - 1, MusArea);
 							if (ParamPtr->Version != 0) {
 								LoadPreParams(ParamPtr);
 							}
@@ -803,7 +1526,7 @@ void DoMenu() {
 								ChangeFeedback(p.Rfeedback, MusType);
 								ChangeDelay(p.Rdelay, MusType);
 								if (LoadPostParams(ParamPtr) > 0) {
-									ChangeRevMode(p.Rmode, MusType);
+									p.Rmode = ChangeRevMode(p.Rmode, MusType);
 									Timeout = TimeoutStart;
 								} else {
 									ChangeRVol(p.RvolL, p.RvolR, MusType);
@@ -891,7 +1614,13 @@ void DoMenu() {
 				if (PadStatus & PADRright) {
 					if (padPressed != PADRright + PADRleft) {
 						padPressedCount=0;
-						p.Rmode = ChangeRevMode((p.Rmode + 1) % 10, MusType);
+						// Modes whose work area would overwrite the music
+						// are skipped
+						for (i=1; i<=10; i++) {
+							RevNext = (p.Rmode + i) % 10;
+							if (ChangeRevMode(RevNext, MusType) == RevNext) break;
+						}
+						if (i <= 10) p.Rmode = RevNext;
 						//printf("%hi %i\n", p.Rmode, p.Rmode);
 						Timeout = TimeoutStart;
 					}
@@ -1000,16 +1729,108 @@ void DoMenu() {
 					padPressed = PADstart + PADRleft;
 				}
 			
+			} else if (PadStatus & PADselect) {
+				
+				// Select on its own stops the music once let go, held with
+				// other buttons it searches the menu instead
+				if ((padPressed & PADselect) == 0) SelectUsed = false;
+				if (PadStatus == PADselect) padPressed = PADselect;
+				
+				// Jump to the previous/next first letter
+				if (PadStatus & PADLleft) {
+					if (padPressed != PADLleft + PADselect) TitleJump(-1);
+					SelectUsed = true;
+					padPressed = PADLleft + PADselect;
+				}
+				if (PadStatus & PADLright) {
+					if (padPressed != PADLright + PADselect) TitleJump(1);
+					SelectUsed = true;
+					padPressed = PADLright + PADselect;
+				}
+				
+				// Add a character to the filter
+				if (PadStatus & PADR1) {
+					if (padPressed != PADR1 + PADselect) FilterAdd();
+					SelectUsed = true;
+					padPressed = PADR1 + PADselect;
+				}
+				
+				// Take the last character off
+				if (PadStatus & PADL1) {
+					if (padPressed != PADL1 + PADselect) FilterBack();
+					SelectUsed = true;
+					padPressed = PADL1 + PADselect;
+				}
+				
+				// Straight back to the first menu
+				if (PadStatus & PADstart) {
+					if (padPressed != PADstart + PADselect) {
+						CancelLoad();
+						LSMI = MAX_TITLES + 1;
+						FilterLen = 0;
+						if (NavDepth > 1) NavDepth = 1;
+						MusType = MenuReturn(MusType);
+					}
+					SelectUsed = true;
+					padPressed = PADstart + PADselect;
+				}
+				
+				// Playlist on or off, and queueing the entry under the cursor
+				if (PadStatus & PADRright) {
+					if (padPressed != PADRright + PADselect) {
+						Playlist.On = (Playlist.On == false);
+						if (Playlist.On == false) PlaylistClear();
+					}
+					SelectUsed = true;
+					padPressed = PADRright + PADselect;
+				}
+				if (PadStatus & PADRdown) {
+					// An entry still shown as dots isn't read for this while
+					// XA or CD audio plays, it would stop the music
+					if ((padPressed != PADRdown + PADselect) && ((TitlePeek(SelTitle) != 0) || ((MusType != MUSIC_XA) && (MusType != MUSIC_DA)))) {
+						PlaylistQueue(SelTitle);
+					}
+					SelectUsed = true;
+					padPressed = PADRdown + PADselect;
+				}
+				
+				// Change the last character
+				if (PadStatus & PADLup) {
+					if (padPressed != PADLup + PADselect) {
+					FilterStep(-1);
+					padPressedCount = 0;
+					}
+					if (padPressedCount >= 32) padPressedCount = 30;
+					if (padPressedCount == 30) FilterStep(-1);
+					padPressedCount += 1;
+					SelectUsed = true;
+					padPressed = PADLup + PADselect;
+				}
+				if (PadStatus & PADLdown) {
+					if (padPressed != PADLdown + PADselect) {
+					FilterStep(1);
+					padPressedCount = 0;
+					}
+					if (padPressedCount >= 32) padPressedCount = 30;
+					if (padPressedCount == 30) FilterStep(1);
+					padPressedCount += 1;
+					SelectUsed = true;
+					padPressed = PADLdown + PADselect;
+				}
+				
 			} else {
 				
+				// The cursor moves through the entries shown
+				SelPos = (FilterLen == 0) ? SelTitle : ViewPos;
+				
 				if (PadStatus & PADLup) {
-					if (SelTitle > 0) {
+					if (SelPos > 0) {
 						if (padPressed != PADLup)	{
-						SelTitle -= 1;
+						SelPos -= 1;
 						padPressedCount = 0;
 						}
 						if (padPressedCount >= 32) padPressedCount = 30;
-						if (padPressedCount == 30) SelTitle -= 1;
+						if (padPressedCount == 30) SelPos -= 1;
 						padPressedCount += 1;
 					}
 					padPressed = PADLup;
@@ -1017,13 +1838,13 @@ void DoMenu() {
 				
 				// Select down
 				if (PadStatus & PADLdown) {
-					if (SelTitle < (NumTitles - 1)) {
+					if (SelPos < (ViewCount() - 1)) {
 						if (padPressed != PADLdown) {	
-						SelTitle += 1;
+						SelPos += 1;
 						padPressedCount = 0;
 						}
 						if (padPressedCount >= 32)	padPressedCount = 30;
-						if (padPressedCount == 30)	SelTitle += 1;
+						if (padPressedCount == 30)	SelPos += 1;
 						padPressedCount += 1;
 					}
 					padPressed = PADLdown;
@@ -1031,37 +1852,38 @@ void DoMenu() {
 				
 				// Select up 10
 				if (PadStatus & PADLleft) {
-					if (SelTitle > 9) {
+					if (SelPos > 9) {
 						if (padPressed != PADLleft)	{
-						SelTitle -= 10;
+						SelPos -= 10;
 						padPressedCount = 0;
 						}
 						if (padPressedCount >= 32) padPressedCount = 30;
-						if (padPressedCount == 30) SelTitle -= 10;
+						if (padPressedCount == 30) SelPos -= 10;
 						padPressedCount += 1;
 					} else {
 						padPressedCount = 0;
-						SelTitle = 0;
+						SelPos = 0;
 					}
 					padPressed = PADLleft;
 				}
 				
 				// Select down 10
 				if (PadStatus & PADLright) {
-					if (SelTitle < (NumTitles - 10)) {
+					if (SelPos < (ViewCount() - 10)) {
 						if (padPressed != PADLright) {	
-						SelTitle += 10;
+						SelPos += 10;
 						padPressedCount = 0;
 						}
 						if (padPressedCount >= 32)	padPressedCount = 30;
-						if (padPressedCount == 30)	SelTitle += 10;
+						if (padPressedCount == 30)	SelPos += 10;
 						padPressedCount += 1;
 					} else {
 						padPressedCount = 0;
-						SelTitle = NumTitles - 1;
+						SelPos = ViewCount() - 1;
 					}
 					padPressed = PADLright;
 				}
+				ViewSelect(SelPos);
 				
 				// Select Track Up
 				if (PadStatus & PADR1) {
@@ -1145,32 +1967,17 @@ void DoMenu() {
 					#endif
 				}
 				
-				if (PadStatus & PADselect) {
-					if (padPressed != PADselect) {
-						padPressedCount=0;
-						StopMusic(MusType);
-						UnloadMusic(MusType);
-						LoadMusic(MusType); //clear out spu ram
-						UnloadMusic(MusType);
-						LSMI = MAX_TITLES + 1;
-						MusType = MUSIC_NONE;
-					}
-					padPressedCount += 1;
-					padPressed = PADselect;
-					#if DEBUG
-					printf("%i presses now\n", padPressedCount);
-					#endif
-				}
-				
 				if (PadStatus & PADstart) {
 					if (padPressed != PADstart) {
 						padPressedCount=0;
-						StopMusic(MusType);
-						UnloadMusic(MusType);
-						MusType = MUSIC_NONE;
-						SelTitle = 0;
+						CancelLoad();
 						LSMI = MAX_TITLES + 1;
-						InitTitles("\\PSFMENU\\TITLES.TXT", 0, 0);
+						// Drops the filter first
+						if (FilterLen > 0) {
+							FilterLen = 0;
+						} else {
+							MusType = MenuReturn(MusType);
+						}
 					}
 					padPressedCount += 1;
 					padPressed = PADstart;
@@ -1180,180 +1987,25 @@ void DoMenu() {
 				}
 			
 			}
-			// Start game
-			if (PadStatus & PADRdown) {
+			// Start game, unless a forced stack already chose the title
+			if ((PadStatus & PADRdown) && ((PadStatus & PADselect) == 0) && (TitleChosen == false)) {
 				if (padPressed != PADRdown) {
-					if (PadStatus & PADRup) {
-						if (Title[SelTitle].StackAddr == MUSIC_SEQ || ((Title[SelTitle].StackAddr >= SEQ_MIN) && (Title[SelTitle].StackAddr <= SEQ_MAX))) {
-							if (Title[SelTitle].StackAddr == MUSIC_SEQ) {
-								CDRF(Title[SelTitle].ExecFile, (u_long*)MOD_AREA, Title[SelTitle].SectorStart, Title[SelTitle].SectorLength);
-								CdReadSync(0, 0);
-								ParamPtr = ParamFile(0, (u_long*)MOD_AREA);
-								LSMI = MAX_TITLES + 1;
-							} else if (LSMI <= MAX_TITLES && Title[LSMI].SectorStart == Title[SelTitle].SectorStart && Title[LSMI].SectorLength == Title[SelTitle].SectorLength && strncmp(Title[LSMI].ExecFile, Title[SelTitle].ExecFile, 52) == 0) {
-								ParamPtr = ParamFile(Title[SelTitle].StackAddr - SEQ_MIN, (u_long*)MOD_AREA);
-								LSMI = SelTitle;
-							} else {
-								CDRF(Title[SelTitle].ExecFile, (u_long*)MOD_AREA, Title[SelTitle].SectorStart, Title[SelTitle].SectorLength);
-								CdReadSync(0, 0);
-								ParamPtr = ParamFile(Title[SelTitle].StackAddr - SEQ_MIN, (u_long*)MOD_AREA);
-								LSMI = SelTitle;
-							}
-							if (ParamPtr->Version != 0) {
-								LoadPreParams(ParamPtr);
-							}
-							if (ParamPtr->Version != 0) {
-								ChangeFeedback(p.Rfeedback, MusType);
-								ChangeDelay(p.Rdelay, MusType);
-								if (LoadPostParams(ParamPtr) > 0) {
-									ChangeRevMode(p.Rmode, MusType);
-									Timeout = TimeoutStart;
-								} else {
-									ChangeRVol(p.RvolL, p.RvolR, MusType);
-									ChangeRDepth(p.RdepthL, p.RdepthR, MusType);
-								}
-							}
-						}
-					} else {
-						if ((Title[SelTitle].StackAddr >= SEP_MIN) && (Title[SelTitle].StackAddr <= SEP_MAX)) {
-							if (LSMI <= MAX_TITLES && Title[LSMI].SectorStart == Title[SelTitle].SectorStart && Title[LSMI].SectorLength == Title[SelTitle].SectorLength && strncmp(Title[LSMI].ExecFile, Title[SelTitle].ExecFile, 52) == 0) {
-								#if DEBUG
-								printf("Multitrack correct, switching track to %i\n", Title[SelTitle].StackAddr - SEP_MIN);
-								#endif
-								curtrk = ChangeTrack(Title[SelTitle].StackAddr - SEP_MIN, MUSIC_SEP);
-							} else {
-								#if DEBUG
-								printf("Multitrack incorrect, switching track to %i\n", Title[SelTitle].StackAddr - SEP_MIN);
-								#endif
-								StopMusic(MusType);
-								if (MusType != MUSIC_SEP) {
-									#if DEBUG
-									printf("Changing music type to SEP\n");
-									#endif
-									UnloadMusic(MusType);
-									LoadMusic(MUSIC_SEP);
-									MusType = MUSIC_SEP;
-									
-								}
-								LoadSep(Title[SelTitle].ExecFile, (u_long*)MOD_AREA, Title[SelTitle].SectorStart, Title[SelTitle].SectorLength, (short)(Title[SelTitle].StackAddr - SEP_MIN));
-								LSMI = SelTitle;
-							}
-						} else if ((Title[SelTitle].StackAddr >= SEQ_MIN) && (Title[SelTitle].StackAddr <= SEQ_MAX)) {
-							if (LSMI <= MAX_TITLES && Title[LSMI].SectorStart == Title[SelTitle].SectorStart && Title[LSMI].SectorLength == Title[SelTitle].SectorLength && strncmp(Title[LSMI].ExecFile, Title[SelTitle].ExecFile, 52) == 0) {
-								#if DEBUG
-								printf("Multitrack correct. Switching track to %i\n", Title[SelTitle].StackAddr - SEQ_MIN);
-								#endif
-								ParamPtr = ParamFile(Title[SelTitle].StackAddr - SEQ_MIN, (u_long*)MOD_AREA);
-								if (ParamPtr->Version != 0 && !(PadStatus & PADRleft)) {
-									LoadPreParams(ParamPtr);
-								}
-								curtrk = ChangeTrack(Title[SelTitle].StackAddr - SEQ_MIN, MUSIC_SEQ);
-								if (ParamPtr->Version != 0 && !(PadStatus & PADRleft)) {
-									ChangeFeedback(p.Rfeedback, MusType);
-									ChangeDelay(p.Rdelay, MusType);
-									if (LoadPostParams(ParamPtr) > 0) {
-										ChangeRevMode(p.Rmode, MusType);
-										Timeout = TimeoutStart;
-									} else {
-										ChangeRVol(p.RvolL, p.RvolR, MusType);
-										ChangeRDepth(p.RdepthL, p.RdepthR, MusType);
-									}
-								}
-							} else {
-								#if DEBUG
-								printf("Multitrack incorrect. Switching track to %i\n", Title[SelTitle].StackAddr - SEQ_MIN);
-								#endif
-								StopMusic(MusType);
-								CDRF(Title[SelTitle].ExecFile, (u_long*)MOD_AREA, Title[SelTitle].SectorStart, Title[SelTitle].SectorLength);
-								CdReadSync(0, 0);
-								ParamPtr = ParamFile(Title[SelTitle].StackAddr - SEQ_MIN, (u_long*)MOD_AREA);
-								#if DEBUG
-									printf("Paramater Pointer: %p\n", ParamPtr);
-								#endif
-								if (ParamPtr->Version != 0 && !(PadStatus & PADRleft)) {
-									LoadPreParams(ParamPtr);
-								}
-								if (MusType != MUSIC_SEQ) {
-									#if DEBUG
-									printf("Changing music type to SEQ\n");
-									#endif
-									UnloadMusic(MusType);
-									LoadMusic(MUSIC_SEQ);
-									MusType = MUSIC_SEQ;
-									
-								}
-								
-								LoadSeq((u_long*)MOD_AREA, (short)(Title[SelTitle].StackAddr - SEQ_MIN), SeqParamCount((u_long*)MOD_AREA));
-								if (ParamPtr->Version != 0 && !(PadStatus & PADRleft)) {
-									ChangeFeedback(p.Rfeedback, MusType);
-									ChangeDelay(p.Rdelay, MusType);
-									if (LoadPostParams(ParamPtr) > 0) {
-										ChangeRevMode(p.Rmode, MusType);
-										Timeout = TimeoutStart;
-									} else {
-										ChangeRVol(p.RvolL, p.RvolR, MusType);
-										ChangeRDepth(p.RdepthL, p.RdepthR, MusType);
-									}
-								}
-								//Timeout = TimeoutStart;
-								LSMI = SelTitle;
-							}
-						} else if (Title[SelTitle].StackAddr >= XA_MIN && Title[SelTitle].StackAddr <= XA_MAX) {
-							if (LSMI <= MAX_TITLES && strncmp(Title[LSMI].ExecFile, Title[SelTitle].ExecFile, 52) == 0) {
-								LSMI = SelTitle;
-								LoadXA(Title[SelTitle].ExecFile, Title[SelTitle].StackAddr - XA_MIN, false);
-								MusType = MUSIC_XA;
-							} else {
-								LSMI = SelTitle;
-								LoadXA(Title[SelTitle].ExecFile, Title[SelTitle].StackAddr - XA_MIN, true);
-								MusType = MUSIC_XA;
-							}
-						} else switch (Title[SelTitle].StackAddr) {
-							case MUSIC_NONE:
-							case MUSIC_MOD:
-							case MUSIC_SEQ:
-							case MUSIC_SEP:
-							case MUSIC_VAG:
-							case MUSIC_DA:
-							case MUSIC_XA:
-								#if DEBUG
-								printf("chosen: %s %i\n", Title[SelTitle].ExecFile, Title[SelTitle].StackAddr);
-								#endif
-								if (PadStatus & PADRleft) {
-									MusType = StartMusic(&Title[SelTitle], MusType, 0);
-								} else { 
-									MusType = StartMusic(&Title[SelTitle], MusType, 1);
-								}
-								MusPlaying = true;
-								LSMI = MAX_TITLES + 1;
-								Timeout = TimeoutStart;
-								break;
-							case MENU_TXT:
-								StopMusic(MusType);
-								UnloadMusic(MusType);
-								MusType = MUSIC_NONE;
-								sprintf(StringBuff, "%s", Title[SelTitle].ExecFile);
-								SelTitle = 0;
-								LSMI = MAX_TITLES + 1;
-								InitTitles(StringBuff, Title[SelTitle].SectorStart, Title[SelTitle].SectorLength);
-								break;
-							case MENU_VFS:
-								StopMusic(MusType);
-								UnloadMusic(MusType);
-								MusType = MUSIC_NONE;
-								sprintf(StringBuff, "%s", Title[SelTitle].ExecFile);
-								SelTitle = 0;
-								LSMI = MAX_TITLES + 1;
-								InitVfs(StringBuff);
-								break;
-							default:
-								TitleChosen = true;
-								TransCount = 0;
-								break;
-						}
-						padPressed = PADRdown;
-						padPressedCount = 0;
-					}
+					Playlist.Current = (PlaylistMusic(TitleAt(SelTitle))) ? SelTitle : -1;
+					Playlist.Frames = 0;
+					Pick.Title = SelTitle;
+					Pick.PadStatus = PadStatus;
+					Pick.MusType = MusType;
+					Pick.MusPlaying = MusPlaying;
+					Pick.Timeout = false;
+					Pick.Chosen = false;
+					PickFunc = ((PadStatus & PADRup) ? PickReload : PickPlay)[TitleAt(SelTitle)->Kind];
+					if (PickFunc) PickFunc(&Pick);
+					MusType = Pick.MusType;
+					MusPlaying = Pick.MusPlaying;
+					if (Pick.Timeout) Timeout = TimeoutStart;
+					if (Pick.Chosen) TitleChosen = true;
+					padPressed = PADRdown;
+					padPressedCount = 0;
 				} else {
 					padPressedCount++;
 				}
@@ -1362,6 +2014,62 @@ void DoMenu() {
 		}
 		
 		
+		// Play the next entry of the playlist once the music has played out
+		Playlist.Frames++;
+		if (Playlist.On && (TitleChosen == false) && (Load.Handle == 0) && MusicEnded(MusType)) {
+			i = PlaylistNext(true);
+			if (i < 0) {
+				Playlist.On = false;
+			} else {
+				#if DEBUG
+				printf("Playlist moves on to %s\n", TitleAt(i)->Name);
+				#endif
+				Playlist.Current = i;
+				Playlist.Frames = 0;
+				Pick.Title = i;
+				Pick.PadStatus = 0;
+				Pick.MusType = MusType;
+				Pick.MusPlaying = MusPlaying;
+				Pick.Timeout = false;
+				Pick.Chosen = false;
+				PickPlay[TitleAt(i)->Kind](&Pick);
+				MusType = Pick.MusType;
+				MusPlaying = Pick.MusPlaying;
+				if (Pick.Timeout) Timeout = TimeoutStart;
+			}
+		}
+		
+		// Read ahead the entry under the cursor while the drive is idle, or
+		// the next one of the playlist so it follows without a gap
+		if ((Load.Handle == 0) && (TitleChosen == false)) {
+			i = (Playlist.On) ? PlaylistNext(false) : -1;
+			Prefetch((i < 0) ? SelTitle : i, MusType);
+		}
+		
+		// Decode the list around the cursor while nothing streams from the disc
+		if ((TitleChosen == false) && (MusType != MUSIC_XA) && (MusType != MUSIC_DA)) {
+			TitleRefill();
+			MenuPrefetch(Load.Handle == 0);
+		}
+		
+		
+		// Start loading the chosen EXE right away, the music has to go since
+		// the EXE is likely to land on top of it
+		if (TitleChosen && (Exe.Started == false)) {
+			CancelLoad();
+			StopMusic(MusType);
+			UnloadMusic(MusType);
+			MusType = MUSIC_NONE;
+			MusPlaying = false;
+			sprintf(StringBuff, "%s;1", PathName(TitleAt(SelTitle)->Path));
+			sprintf(NameBuff, "%s", TitleAt(SelTitle)->Name);
+			Exe.Stack = TitleAt(SelTitle)->StackAddr;
+			Exe.Started = true;
+			if (LoadEXEfile(StringBuff, &ExeParams, TitleAt(SelTitle)->SectorStart, TitleAt(SelTitle)->SectorLength) == 0) LoadError=true;
+		}
+		if (Exe.Started && (LoadError == false)) ExePoll();
+		
+		
 		// Transition to black if a title was selected
 		if (TitleChosen) TransState = DoTransition2();
 		
@@ -1373,7 +2081,8 @@ void DoMenu() {
 		
 		
 		// Calculate coordinates of the list
-		fListY	+= (((ONE * ((18 * (SelTitle - 7)))) + 9) - fListY) / 8;
+		SelPos	= (FilterLen == 0) ? SelTitle : ViewPos;
+		fListY	+= (((ONE * ((18 * (SelPos - 7)))) + 9) - fListY) / 8;
 		ListY	= (fListY + (ONE / 2)) / ONE;
 		
 		if (ListY < 0) {
@@ -1384,7 +2093,7 @@ void DoMenu() {
 		EndListY	= StartListY + MaxListLength;
 		
 		if (StartListY < 0)			StartListY = 0;
-		if (EndListY > NumTitles)	EndListY = NumTitles;
+		if (EndListY > ViewCount())	EndListY = ViewCount();
 		
 		
 		// Draw the list
@@ -1392,15 +2101,18 @@ void DoMenu() {
 			
 			ItemY = (ListDrawY + (18 * i)) - ListY;
 			
+			// Entries that haven't been decoded yet are left as dots
+			ItemName = (TitlePeek(ViewEntry(i)) != 0) ? TitlePeek(ViewEntry(i))->Name : "...";
+			
 			if (ItemY < (ListDrawY + 72)) {
-				fPrint(Title[i].Name, CENTERED, ItemY, 127 * ((float)((ItemY + 1) - ListDrawY)  / 72), &myOT[ActiveBuffer], FontTIM);
+				fPrint(ItemName, CENTERED, ItemY, 127 * ((float)((ItemY + 1) - ListDrawY)  / 72), &myOT[ActiveBuffer], FontTIM);
 			} else if ((ItemY + 18) >= (ScreenYres - 108)) {
-				fPrint(Title[i].Name, CENTERED, ItemY, 127 - (127 * ((float)(ItemY - (ScreenYres - 108)) / 72)), &myOT[ActiveBuffer], FontTIM);
+				fPrint(ItemName, CENTERED, ItemY, 127 - (127 * ((float)(ItemY - (ScreenYres - 108)) / 72)), &myOT[ActiveBuffer], FontTIM);
 			} else {
-				fPrint(Title[i].Name, CENTERED, ItemY, 127, &myOT[ActiveBuffer], FontTIM);
+				fPrint(ItemName, CENTERED, ItemY, 127, &myOT[ActiveBuffer], FontTIM);
 			}
 			
-			if ((i == SelTitle) && (TitleChosen == false)) {
+			if ((i == SelPos) && (TitleChosen == false)) {
 				SelectionBox.y = ((ListDrawY + (18 * i)) - ListY) - 1;
 				GsSortBoxFill(&SelectionBox, &myOT[ActiveBuffer], 0);
 			}
@@ -1408,6 +2120,31 @@ void DoMenu() {
 		}
 		
 		
+		// Show that the playlist is on
+		if (Playlist.On) {
+			sprintf(LoadText, "Playlist, %i queued", Playlist.Count);
+			fPrint(LoadText, CENTERED, ScreenYres - 84, 127, &myOT[ActiveBuffer], FontTIM);
+		}
+		
+		// Show what the list is filtered by
+		if (FilterLen > 0) {
+			sprintf(LoadText, "Find: %s (%i)", FilterName(), ViewCount());
+			fPrint(LoadText, CENTERED, ScreenYres - 64, 127, &myOT[ActiveBuffer], FontTIM);
+		}
+		
+		// Show how far a background load has come
+		if (Load.Handle && !Load.Ready) {
+			sprintf(LoadText, "Loading... %i%%", CdAsyncProgress(Load.Handle));
+			fPrint(LoadText, CENTERED, ScreenYres - 24, 127, &myOT[ActiveBuffer], FontTIM);
+		}
+		
+		#if CDTRACE
+		i = CdTraceRate(&TraceSeeks);
+		sprintf(LoadText, "CD %iKB/s %i seeks", i, TraceSeeks);
+		fPrint(LoadText, CENTERED, ScreenYres - 44, 127, &myOT[ActiveBuffer], FontTIM);
+		#endif
+		
+		
 		// Process bubbles in the background
 		for (i=0; i<MAX_BUBBLES; i+=1) {
 			
@@ -1471,21 +2208,20 @@ void DoMenu() {
 	// Stop the music
 	//MOD_Stop();
 	//MOD_Free();
+	CancelLoad();
 	StopMusic(MusType);
 	UnloadMusic(MusType);
 	MusType = MUSIC_NONE;
 	
-	// Begin loading the EXE file in the background and get its parameters
-	sprintf(StringBuff, "%s;1", Title[SelTitle].ExecFile);
-	sprintf(NameBuff, "%s", Title[SelTitle].Name);
-
-	if (LoadEXEfile(StringBuff, &ExeParams, Title[SelTitle].SectorStart, Title[SelTitle].SectorLength) == 0) LoadError=true;
+	// The list is no longer needed, let the rest of the EXE in
+	Exe.Guarded = false;
 	
 	
 	// Display the title of the game being loaded
 	ClearRed = ClearGrn = ClearBlu = 0;
 	for (i=0; i<127; i+=2) {
 		PrepDisplay();
+		ExePoll();
 		if (LoadError == false) {
 			fPrint("Now Playing", CENTERED, 220, i, &myOT[ActiveBuffer], FontTIM);
 			fPrint(NameBuff, CENTERED, 240, i, &myOT[ActiveBuffer], FontTIM);
@@ -1499,6 +2235,7 @@ void DoMenu() {
 	// This is to prevent the text from flickering on interlaced displays
 	for (i=0; i<2; i+=1) {
 		PrepDisplay();
+		ExePoll();
 		if (LoadError == false) {
 			fPrint("Now Playing", CENTERED, 220, 128, &myOT[ActiveBuffer], FontTIM);
 			fPrint(NameBuff, CENTERED, 240, 128, &myOT[ActiveBuffer], FontTIM);
@@ -1518,12 +2255,6 @@ void DoMenu() {
 		while (1) VSync(0);
 	}
 	
-	// Wait for the EXE to finally finish loading
-	CdReadSync(0, 0);
-	#if DEBUG
-	printf("EXE loaded successfully.\n");
-	#endif
-	
 }
 int LoadEXEfile(char *FileName, struct EXEC *Params, u_long ssect, u_long nsect) {
 	
@@ -1543,7 +2274,7 @@ int LoadEXEfile(char *FileName, struct EXEC *Params, u_long ssect, u_long nsect)
 	#endif
 	
 	// Search for the file to load
-	if (CdSearchFile(&File, FileName) == 0) {
+	if (CdIndexFile(&File, FileName) == 0) {
 		#if DEBUG
 		printf("File not found: %s\n", FileName);
 		#endif
@@ -1557,15 +2288,21 @@ int LoadEXEfile(char *FileName, struct EXEC *Params, u_long ssect, u_long nsect)
 		CdIntToPos(CdPosToInt(&File.pos)+ssect, &File.pos);
 	}
 	// Seek to the EXE file and read its header
-	CdControl(CdlSetloc, (u_char*)&File.pos, 0);
-	CdRead(1, (u_long*)&Header, Mode);
+	CdAsyncCancel(0);
+	CdTraceSetloc(&File.pos);
+	CdTraceRead("exe header", 1, (u_long*)&Header, Mode, 0);
 	CdReadSync(0, 0);
 	
 	
 	// Get the EXE header data from the sector buffer
 	*Params = Header.Params;
 	
-	#if DEBUG
+	if ((strncmp((char*)Header.Pad, "PS-X EXE", 8) != 0) || (Params->t_addr < 0x80010000) || ((Params->t_addr + Params->t_size) > 0x80200000)) {
+		printf("Not a valid EXE: %s\n", FileName);
+		return(0);
+	}
+	
+	#if DEBUG
 	printf("EXE parameters: %d\n", sizeof(EXEHEADER));
 	printf(" pc0   :%X\n", Params->pc0);
 	printf(" t_addr:%X\n", Params->t_addr);
@@ -1573,28 +2310,89 @@ int LoadEXEfile(char *FileName, struct EXEC *Params, u_long ssect, u_long nsect)
 	printf("Now loading EXE to t_addr...");
 	#endif
 	
-	// Seek to next sector and read the rest of the EXE file
-	CdIntToPos(CdPosToInt(&File.pos)+1, &File.pos);
-	CdControl(CdlSetloc, (u_char*)&File.pos, 0);
-
+	// Read the rest of the EXE file in chunks, the parts over Title[] last
 	if (nsect > 1) {
-		#if DEBUG
-		printf("CD Position set, loading %i sectors...",nsect);
-		#endif
-		CdRead(nsect - 1, (void*)Params->t_addr, Mode);
+		nsect = nsect - 1;
 	} else {
-		#if DEBUG
-		printf("CD Position set, loading rest of file...");
-		#endif
-		CdRead(((File.size - 2048)+2047)/2048, (void*)Params->t_addr, Mode);
+		nsect = ((File.size - 2048)+2047)/2048;
+	}
+	
+	Exe.Lba = CdPosToInt(&File.pos) + 1;
+	Exe.Dest = (u_char*)Params->t_addr;
+	Exe.Start[2] = 0;
+	Exe.End[2] = 0;
+	if ((Params->t_addr < (MENU_AREA + MENU_SIZE)) && ((Params->t_addr + (nsect << 11)) > MENU_AREA)) {
+		if (Params->t_addr < MENU_AREA) Exe.Start[2] = (MENU_AREA - Params->t_addr) >> 11;
+		Exe.End[2] = ((MENU_AREA + MENU_SIZE) - Params->t_addr + 2047) >> 11;
+		if (Exe.End[2] > nsect) Exe.End[2] = nsect;
 	}
+	Exe.Start[0] = 0;
+	Exe.End[0] = Exe.Start[2];
+	Exe.Start[1] = Exe.End[2];
+	Exe.End[1] = nsect;
+	
+	Exe.Range = 0;
+	Exe.Next = 0;
+	Exe.Guarded = true;
+	Exe.Busy = false;
+	
 	#if DEBUG
-	printf("CdRead started...");
+	printf("Loading %i sectors, %i-%i held back...", nsect, Exe.Start[2], Exe.End[2]);
 	#endif
+	
+	ExePoll();
 	return(1);
 	
 }
 
+int ExePoll() {
+	
+	// Starts the next chunk of the EXE body once the last one is in. Returns
+	// true when the whole body is loaded.
+	
+	CdlLOC	pos;
+	int		n;
+	
+	if (Exe.Busy) {
+		// The callback only reports success, check the drive for errors
+		n = CdReadSync(1, 0);
+		if (n > 0) return false;
+		if (n < 0) Exe.Next = Exe.Last;	// Read the chunk again
+		Exe.Busy = false;
+	}
+	
+	while ((Exe.Range < 3) && (Exe.Next >= Exe.End[Exe.Range])) {
+		Exe.Range++;
+		if (Exe.Range < 3) Exe.Next = Exe.Start[Exe.Range];
+	}
+	if (Exe.Range == 3) {
+		CdReadCallback(0);
+		return true;
+	}
+	if ((Exe.Range == 2) && Exe.Guarded) return false;
+	
+	n = Exe.End[Exe.Range] - Exe.Next;
+	if (n > EXE_CHUNK) n = EXE_CHUNK;
+	
+	CdIntToPos(Exe.Lba + Exe.Next, &pos);
+	CdTraceSetloc(&pos);
+	Exe.Busy = true;
+	Exe.Last = Exe.Next;
+	CdTraceRead("exe", n, (u_long*)(Exe.Dest + (Exe.Next << 11)), CdlModeSpeed, (CdlCB)ExeReady);
+	Exe.Next += n;
+	
+	return false;
+	
+}
+
+void ExeReady(u_char intr, u_char *result) {
+	
+	// Read callback, only flags the chunk as done
+	
+	if (intr == CdlComplete) Exe.Busy = false;
+	
+}
+
 void fPrint(char *string, short x, short y, char opacity, GsOT *otptr, GsIMAGE font) {
 	
 	// Draws characters as sprites
@@ -1717,19 +2515,48 @@ void SortBigImage (int x, int y, GsIMAGE TimImage) {
 
 void Init() {
 	
+	int b,status;
+	int trans,gfx=false;
+	char* titlefile;
+	CdlFILE File;
+	
 	// Reset GPU without clearing the VRAM for a nice transition effect
 	ResetGraph(3);	
 	
 	// Init CD
 	CdInit();
+	CdIndexClear();
 	
 	
-	// Start loading the MOD music while transitioning
+	// Start loading the menu graphics and title entries while transitioning,
+	// in one pass over the disc. The title list goes to the second slot as
+	// the graphics need TEMP_AREA.
 	//CdReadFile("\\MUSIC.HIT", (u_long*)MOD_AREA, 0);
+	SlotDrop(0);
+	SlotDrop(1);
+	CdBatchClear();
+	CdBatchAdd("\\PSFMENU\\GRAPHICS.QLP", 0, 0, (u_long*)TEMP_AREA);
+	// Only a list that fits is read along, longer text lists are streamed
+	// once the transition is done.
+	titlefile = TitlesFile("\\PSFMENU\\TITLES.TXT");
+	b = -1;
+	if (CdIndexFile(&File, titlefile) && (File.size <= (TitlesBin(titlefile) ? SLOT_MAXSIZE : MENU_STAGESIZE))) {
+		b = CdBatchAdd(titlefile, 0, 0, (u_long*)SLOT_AREA);
+	}
+	CdBatchStart();
 	
-	// Do a cool transition effect
+	// Do a cool transition effect, the TIMs are uploaded (outside the
+	// framebuffer) as soon as they are in
 	VSync(0);
-	while (DoTransition()) {
+	trans = true;
+	status = CDASYNC_BUSY;
+	while (trans || (status == CDASYNC_BUSY)) {
+		if (trans) trans = DoTransition();
+		if (status == CDASYNC_BUSY) status = CdBatchPoll();
+		if ((gfx == false) && CdBatchLanded((u_long*)TEMP_AREA)) {
+			OpenGraphics((u_long*)TEMP_AREA);
+			gfx = true;
+		}
 		DrawSync(0);
 		VSync(0);
 	}
@@ -1765,11 +2592,22 @@ void Init() {
 	GsClearOt(0, 0, &myOT[0]);
 	GsClearOt(0, 0, &myOT[1]);
 	#if DEBUG
-	printf("CD Mode: %i Title array size: %i Title array location: %X\n", CdMode(), MENU_SIZE, Title);
+	printf("CD Mode: %i Title index size: %i Title index location: %X\n", CdMode(), MENU_SIZE, TitleIndex);
 	#endif
-	// Load the menu graphics and title entries
-	LoadGraphics("\\PSFMENU\\GRAPHICS.QLP", 0, 0);
-	InitTitles("\\PSFMENU\\TITLES.TXT", 0, 0);
+	if (gfx == false) {
+		LoadGraphics("\\PSFMENU\\GRAPHICS.QLP", 0, 0);
+	}
+	
+	// Parse the title entries loaded during the transition. The list is
+	// read again on its own if it wasn't read along or the batch failed.
+	if ((b < 0) || (status != CDASYNC_DONE)) {
+		InitTitles(titlefile, 0, 0);
+	} else {
+		TitleSource(titlefile, 0);
+		ParseTitles((char*)SLOT_AREA, b);
+		MenuCacheKeep((char*)SLOT_AREA, b);
+	}
+	IndexTitles();
 	
 	// Init controller
 	PadInit(0);
@@ -1782,65 +2620,111 @@ void LoadGraphics(char* gfxfile, u_long ssect, u_long nsect) {
 	printf("Loading %s...", gfxfile);
 	#endif
 	//CdReadFile(gfxfile, (u_long*)TEMP_AREA, 0);
+	SlotDrop(0);
 	CDRF(gfxfile, (u_long*)TEMP_AREA, ssect, nsect);
 	CdReadSync(0, 0);
 	
-	FontTIM			= LoadTIM(QLPfilePtr((u_long*)TEMP_AREA, 0));
-	BannerTIM		= LoadTIM(QLPfilePtr((u_long*)TEMP_AREA, 1));
-	BigCircleTIM	= LoadTIM(QLPfilePtr((u_long*)TEMP_AREA, 2));
-	SmallCircleTIM	= LoadTIM(QLPfilePtr((u_long*)TEMP_AREA, 3));
+	OpenGraphics((u_long*)TEMP_AREA);
 	
 	#if DEBUG
 	printf("Done.\n");
-	printf("FONT ADDR: %X\n",QLPfilePtr((u_long*)TEMP_AREA, 0));
+	#endif
+	
+}
+
+void OpenGraphics(u_long* addr) {
+	
+	// Upload all the TIMs in a loaded graphics pack onto VRAM
+	
+	FontTIM			= LoadTIM(QLPfilePtr(addr, 0));
+	BannerTIM		= LoadTIM(QLPfilePtr(addr, 1));
+	BigCircleTIM	= LoadTIM(QLPfilePtr(addr, 2));
+	SmallCircleTIM	= LoadTIM(QLPfilePtr(addr, 3));
+	
+	#if DEBUG
+	printf("FONT ADDR: %X\n",QLPfilePtr(addr, 0));
 	#endif
 	
 }
 
 void InitVfs(char* vfsfile) {
-	typedef struct {
-		char	name[64];
-		u_long	size;
-		u_long	addr;
-		u_long	sector_size;
-		u_long	byte_addr;
-		u_long	stack;
-	} VFSFILE;
-	CdlFILE cdf;
-	int sect, titlenum;
-	int i;
-	VFSFILE* titles = (VFSFILE*)TITLE_AREA;
-	sprintf(NameBuff, "%s;1", vfsfile);
+	int sect;
+	u_long* dir;
 	//CDRF(vfsfile, (u_long*)TEMP_AREA, 0, 1);
-	if (CdSearchFile(&cdf, NameBuff) == 0) {
-		printf("VFS not found: %s\n", NameBuff);
+	if (CDRF(vfsfile, (u_long*)MENU_STAGE, 0, 1) < 0) {
+		printf("VFS not found: %s\n", vfsfile);
 		return;
 	}
-	CdControl(CdlSetloc, (u_char*)&cdf.pos, 0);
-	CdRead(1, (u_long*)TEMP_AREA, CdlModeSpeed);
 	CdReadSync(0, 0);
-	sect = *((u_long*)TEMP_AREA + 2);
-	titlenum = *((u_long*)TEMP_AREA + 1);
-	#if DEBUG
-	printf("VFS: %s Load Location: %x\n",vfsfile,TEMP_AREA);
-	printf("VFS Sectors to load: %i Titles in VFS:%i\n", sect, titlenum);
-	#endif
+	sect = *((u_long*)MENU_STAGE + 2);
+	dir = (u_long*)MenuStage(sect << 11);
+	if (dir != (u_long*)MENU_STAGE) {
+		memcpy(dir, (u_long*)MENU_STAGE, 2048);
+	}
 	if (sect > 1) {
-		CdIntToPos(CdPosToInt(&cdf.pos) + 1, &cdf.pos);
-		CdControl(CdlSetloc, (u_char*)&cdf.pos, 0);
-		CdRead(sect - 1, (u_long*)CONT_AREA, CdlModeSpeed);
+		CDRF(vfsfile, dir + 512, 1, sect - 1);
 		CdReadSync(0, 0);
 	}
+	ParseVfs(vfsfile, dir);
+	MenuCacheKeep((char*)dir, sect << 11);
+}
+
+char* MenuStage(int bytes) {
+	
+	// Where a list file of so many bytes is read to. Bigger lists than the
+	// staging buffer take slot 0, the caller has to stop its music first.
+	
+	if (bytes <= MENU_STAGESIZE) return (char*)MENU_STAGE;
+	
+	SlotDrop(0);	// TEMP_AREA is inside slot 0
+	return (char*)TEMP_AREA;
+	
+}
+
+void ParseVfs(char* vfsfile, u_long* dir) {
+	// Builds the title list from a VFS directory already loaded to dir
+	int titlenum;
+	int i;
+	VFSHEAD* head = (VFSHEAD*)dir;
+	char* titles = (char*)(dir + 3);
+	u_long record = sizeof(VFSFILE);
+	TITLESTRUCT entry;
+	titlenum = dir[1];
+	if (strncmp(head->Magic, "VFS2", 4) == 0) {
+		if (head->Version != VFS_VERSION) {
+			printf("Unknown VFS version %i: %s\n", head->Version, vfsfile);
+			titlenum = 0;
+		}
+		titles = (char*)(head + 1);
+		record = sizeof(VFSFILE2);
+		// A patched pack doesn't have to be searched for, even when the
+		// menu comes from the cache
+		if ((head->Lba != 0) && (CdIndexAdd(vfsfile, head->Lba, head->Size) != head->Lba)) {
+			printf("%s has moved since it was patched\n", vfsfile);
+		}
+	}
+	#if DEBUG
+	printf("VFS: %s Load Location: %x\n",vfsfile,dir);
+	printf("VFS Sectors loaded: %i Titles in VFS:%i Entry size: %i\n", dir[2], titlenum, record);
+	#endif
+	TitleSource(vfsfile, 0);
+	TitleSrc.Kind = TITLESRC_VFS;
+	TitleSrc.Record = record;
+	TitleSrc.Size = (u_long)(titles + (titlenum * record)) - (u_long)dir;
+	if (titlenum > MAX_TITLES) {
+		printf("More than %i titles, the rest are left out\n", MAX_TITLES);
+		titlenum = MAX_TITLES;
+	}
 	for (i=0; i<titlenum; i++) {
-		Title[i].StackAddr = titles[i].stack;
-		Title[i].SectorStart = titles[i].addr;
-		Title[i].SectorLength = titles[i].sector_size;
-		sprintf(Title[i].Name, "%s", titles[i].name);
-		sprintf(Title[i].ExecFile, "%s", vfsfile);
-		#if DEBUG
-		//printf("Title Area: %X\n", titles);
-		//printf("Title %i - Stack %x - Start Sector %i - Size %i\nName %s\nByteSize: %i ByteAddr: %i\n\n",i,Title[i].StackAddr,Title[i].SectorStart,Title[i].SectorLength,Title[i].Name,titles[i].size,titles[i].byte_addr);
-		#endif
+		TitleRoom(i);
+		if (record == sizeof(VFSFILE2)) {
+			VfsEntry2(&entry, (VFSFILE2*)(titles + (i * record)));
+		} else {
+			VfsEntry(&entry, (VFSFILE*)(titles + (i * record)));
+		}
+		TitleIndex[i].Offset = (u_long)(titles + (i * record)) - (u_long)dir;
+		TitleIndex[i].StackAddr = entry.StackAddr;
+		TitleStore(i, &entry, vfsfile);
 	}
 	NumTitles = titlenum;
 	
@@ -1848,108 +2732,105 @@ void InitVfs(char* vfsfile) {
 
 void InitTitles(char* titlefile, u_long ssect, u_long nsect) {
 	
-	
-	int		i=0,InQuote=0,TitleNum=0,GrabStep=0,Separator=0,CharNum=0,j=0;
-	int b=0;
-	char	AddrText[16]={0};
-	//char	TextBuff[LISTFILE_MAXSIZE]={0};
-	char*	TextBuff=(char*)TEMP_AREA;
+	TITLEPARSE	tp;
+	CdlFILE		File;
+	CdlLOC		pos;
+	char*		TextBuff[2];
+	char*		buff;
+	int			b=0,lba=0,sects=0,next=0,len=0,half=0,failed=false;
 	
 	#if DEBUG
 	printf("Loading %s...", titlefile);
 	#endif
 	
-	// Load LIST.TXT
+	// Load LIST.TXT, or its compiled form if there is one
 	//CdReadFile(titlefile, (u_long*)TextBuff, 0);
-	b = CDRF(titlefile, (u_long*)TextBuff, ssect, nsect);
-	CdReadSync(0, 0);
-	TextBuff[b]=0;
+	if (nsect == 0) titlefile = TitlesFile(titlefile);
+	TitleSource(titlefile, ssect);
+	
+	// Compiled lists are small, read them whole. Going back to a menu passes
+	// a copy of the name, so it is told by its extension.
+	if (TitlesBin(titlefile)) {
+		buff = (char*)MENU_STAGE;
+		if (CdIndexFile(&File, titlefile)) {
+			b = (nsect == 0) ? File.size : (nsect << 11);
+			if (b > MOD_MAXSIZE) {
+				printf("Title list too big: %s\n", titlefile);
+				return;
+			}
+			buff = MenuStage(b);
+		}
+		b = CDRF(titlefile, (u_long*)buff, ssect, nsect);
+		CdReadSync(0, 0);
+		if (b < 0) b = 0;
+		ParseTitles(buff, b);
+		MenuCacheKeep(buff, b);
+		return;
+	}
 	
-	for (j=0;j<52;j++) {
-		Title[0].ExecFile[j] = '\0';
+	// Text is parsed a chunk at a time while the next chunk is being read,
+	// so lists of any length only need two chunks of buffer
+	ParseTitlesStart(&tp);
+	
+	if (CdIndexFile(&File, titlefile) == 0) {
+		printf("Title list not found: %s\n", titlefile);
+		ParseTitlesEnd(&tp);
+		return;
 	}
-	for (j=0;j<64;j++) {
-		Title[0].Name[j] = '\0';
+	if (nsect == 0) {
+		b = File.size;
+		nsect = (File.size + 2047) >> 11;
+	} else {
+		b = nsect << 11;
 	}
-
-	Title[0].SectorStart = 0;
-	Title[0].SectorLength = 0;
+	lba = CdPosToInt(&File.pos) + ssect;
+	TitleSrc.Size = b;
 	
-	// Scan the file's text
-	for (i=0; TextBuff[i] != 0; i+=1) {
+	TextBuff[0] = (char*)MENU_STAGE;
+	TextBuff[1] = TextBuff[0] + (LISTFILE_CHUNK << 11);
+	
+	CdAsyncCancel(0);
+	sects = (nsect < LISTFILE_CHUNK) ? nsect : LISTFILE_CHUNK;
+	CdIntToPos(lba, &pos);
+	CdTraceSetloc(&pos);
+	CdTraceRead(titlefile, sects, (u_long*)TextBuff[0], CdlModeSpeed, 0);
+	
+	while (sects > 0) {
 		
-		if (InQuote == false) {
-			
-			if (TextBuff[i] == '"') {	// If quote detected, start grabbing characters
-				CharNum = 0;
-				InQuote = true;
-				Separator = false;
-			}
-			
-		} else {
-			
-			if (TextBuff[i] == '"') {	// If quote detected, end character grabbing
-			/*
-				if (GrabStep == 0) {
-					GrabStep = 1;
-				} else if (GrabStep == 1) {
-					GrabStep = 2;
-				} else {
-					GrabStep = 0;
-					Title[TitleNum].StackAddr = hex2int(AddrText);
-					TitleNum += 1;
-				}
-			*/	
-				switch (GrabStep) {
-					case 0:
-						GrabStep = 1;
-						break;
-					case 1:
-						GrabStep = 2;
-						break;
-					case 2:
-						GrabStep = 0;
-						Title[TitleNum].StackAddr = hex2int(AddrText);
-						TitleNum += 1;
-						for (j=0;j<52;j++) {
-							Title[TitleNum].ExecFile[j] = '\0';
-						}
-						for (j=0;j<64;j++) {
-							Title[TitleNum].Name[j] = '\0';
-						}
-						Title[TitleNum].SectorStart = 0;
-						Title[TitleNum].SectorLength = 0;
-						break;
-					default:
-						break;
-					}
-				InQuote = false;
-				
-			} else {
-			
-				switch (GrabStep) {
-					case 0:	// Grab title name
-						Title[TitleNum].Name[CharNum] = TextBuff[i];
-						CharNum += 1;
-						break;
-					case 1:	// Grab executable file name
-						Title[TitleNum].ExecFile[CharNum] = TextBuff[i];
-						CharNum += 1;
-						break;
-					case 2:	// Grab stack address in hex
-						AddrText[CharNum] = TextBuff[i];
-						CharNum += 1;
-						AddrText[CharNum] = 0x00;	// Add null byte just in case
-						break;
-				}
-				
-			}
-			
+		if (CdReadSync(0, 0) < 0) {
+			printf("Title list read failed: %s\n", titlefile);
+			failed = true;
+			break;
+		}
+		
+		lba += sects;
+		nsect -= sects;
+		next = (nsect < LISTFILE_CHUNK) ? nsect : LISTFILE_CHUNK;
+		if (next > 0) {
+			CdIntToPos(lba, &pos);
+			CdTraceSetloc(&pos);
+			CdTraceRead(titlefile, next, (u_long*)TextBuff[half ^ 1], CdlModeSpeed, 0);
+		}
+		
+		len = (b < (sects << 11)) ? b : (sects << 11);
+		b -= len;
+		
+		if (ParseTitlesChunk(&tp, TextBuff[half], len) == false) {
+			if (next > 0) CdReadSync(0, 0);
+			break;
 		}
 		
+		sects = next;
+		half ^= 1;
+		
 	}
 	
-	NumTitles = TitleNum;
+	ParseTitlesEnd(&tp);
+	
+	// Lists that fit the two chunks are still whole in the buffer
+	if ((failed == false) && (TitleSrc.Size <= MENUCACHE_MAXFILE)) {
+		MenuCacheKeep(TextBuff[0], TitleSrc.Size);
+	}
 	
 	#if DEBUG
 	printf("Done.\n");
@@ -1957,301 +2838,2883 @@ void InitTitles(char* titlefile, u_long ssect, u_long nsect) {
 	
 }
 
-int hex2int(char *string) {
-
-	// A tiny little function to convert a string of 8 hex characters
-	// into a 32-bit integer.
+void ParseTitles(char* TextBuff, int b) {
 	
-	int		i=0,r=0;
-	char	c=0;
+	// Builds the title list from a TITLES.TXT (or TITLES.BIN) file of b bytes
+	// in TextBuff
 	
-	for (i=0; *(string+i) != 0x00; i+=1) {
-		
-		c=*(string+i);
-		if ((c >= 48) && (c <= 57)) {
-			r |= (c-48)<<(4*(7-i));
-		} else if ((c >= 65) && (c <= 70)) {
-			r |= (10+(c-65))<<(4*(7-i));
-		}
-		
+	TITLEPARSE	tp;
+	
+	TitleSrc.Size = b;
+	if ((b >= sizeof(TITLESBIN)) && (strncmp(TextBuff, "TBIN", 4) == 0)) {
+		if (ParseTitlesBin(TextBuff, b)) return;
 	}
 	
-	return(r);
-
-}
-float frand() {
+	ParseTitlesStart(&tp);
+	ParseTitlesChunk(&tp, TextBuff, b);
+	ParseTitlesEnd(&tp);
 	
-	// Simplified random number generator
+}
+
+void ParseTitlesStart(TITLEPARSE* tp) {
 	
-	return((float)rand() / 32767);
+	memset(tp, 0, sizeof(TITLEPARSE));
+	tp->Last = MAX_TITLES;
+	TitleSrc.Kind = TITLESRC_TXT;
 	
 }
 
-int DoTransition() {
+int ParseTitlesChunk(TITLEPARSE* tp, char* TextBuff, int b) {
 	
-	// Simple transition effect routine (framebuffer based)
+	// Scans b bytes of TITLES.TXT, which may end anywhere, even inside a
+	// quote. Fields longer than they can hold are cut short. Returns false
+	// once the end of the list (or tp->Last) is reached.
 	
-	RECT Box = { 0, 0, 640, 1 };
-	int BoxHeight=0;
-	int i=0;
-
-	if (TransCount) {
+	int		i=0;
+	char	c;
+	
+	if (tp->TitleNum >= tp->Last) return false;
+	
+	// Scan the file's text
+	for (i=0; i<b; i+=1) {
 		
-		for (i=0;i<15;i+=1) {
+		c = TextBuff[i];
+		if ((c == 0) || ((u_char)c == 0x80)) return false;	// End of file character
+		
+		if (tp->InQuote == false) {
 			
-			if (TransCount > (2 * i)) {
+			if (c == '"') {	// If quote detected, start grabbing characters
+				if (tp->GrabStep == 0) tp->Start = tp->Pos + i;
+				tp->CharNum = 0;
+				tp->InQuote = true;
+			}
 			
-				BoxHeight = TransCount - (2 * i);
-				
-				if (BoxHeight < 0)	BoxHeight = 0;
-				if (BoxHeight > 32)	BoxHeight = 32;
-				
-				if (BoxHeight > 0) {
-					Box.y = (32 * i) + BoxHeight;
-					ClearImage2(&Box, CLR_RED, CLR_GRN, CLR_BLU);
-				}
+		} else if (c == '"') {	// If quote detected, end character grabbing
+			
+			switch (tp->GrabStep) {
+				case 0:
+					tp->GrabStep = 1;
+					break;
+				case 1:
+					tp->GrabStep = 2;
+					break;
+				case 2:
+					tp->GrabStep = 0;
+					if (tp->Refill == false) {
+						TitleRoom(tp->TitleNum);
+						TitleIndex[tp->TitleNum].Offset = tp->Start;
+						TitleIndex[tp->TitleNum].StackAddr = hex2int(tp->AddrText);
+					}
+					TitleStore(tp->TitleNum, &tp->Cur, tp->File);
+					tp->TitleNum += 1;
+					if (tp->TitleNum == tp->Last) {
+						if (tp->Last == MAX_TITLES) {
+							printf("More than %i titles, the rest are left out\n", MAX_TITLES);
+						}
+						return false;
+					}
+					memset(&tp->Cur, 0, sizeof(TITLESTRUCT));
+					memset(tp->File, 0, sizeof(tp->File));
+					break;
+			}
+			tp->InQuote = false;
+			
+		} else {
 			
+			switch (tp->GrabStep) {
+				case 0:	// Grab title name
+					if (tp->CharNum < 63) {
+						tp->Cur.Name[tp->CharNum++] = c;
+					}
+					break;
+				case 1:	// Grab executable file name
+					if (tp->CharNum < 51) {
+						tp->File[tp->CharNum++] = c;
+					}
+					break;
+				case 2:	// Grab stack address in hex
+					if (tp->CharNum < 15) {
+						tp->AddrText[tp->CharNum++] = c;
+						tp->AddrText[tp->CharNum] = 0x00;	// Add null byte just in case
+					}
+					break;
 			}
 			
 		}
 		
 	}
 	
-	if (TransCount < 96) {
-		TransCount += 1;
-		return(1);
-	} else {
-		return(0);
-	}
+	tp->Pos += b;
+	return true;
 	
 }
-int DoTransition2() {
+
+void ParseTitlesEnd(TITLEPARSE* tp) {
 	
-	// Simple transition effect routine
+	NumTitles = tp->TitleNum;
 	
-	GsBOXF Box = { 0, 0, 0, 640, 0, 0, 0, 0 };
-	int BoxHeight=0;
-	int i=0;
+}
 
-	if (TransCount) {
-		
-		for (i=0;i<15;i+=1) {
-			
-			if (TransCount > (2 * i)) {
-			
-				BoxHeight = TransCount - (2 * i);
-				
-				if (BoxHeight < 0)	BoxHeight = 0;
-				if (BoxHeight > 32)	BoxHeight = 32;
-				
-				if (BoxHeight > 0) {
-					Box.y = (32 * i);
-					Box.h = BoxHeight;
-					GsSortBoxFill(&Box, &myOT[ActiveBuffer], 0);
-				}
-			
-			}
-			
-		}
-		
+int ParseTitlesBin(char* buff, int b) {
+	
+	// Builds the title list from a compiled TITLES.BIN of b bytes in buff.
+	// Returns false if it doesn't look valid.
+	
+	TITLESBIN*		head=(TITLESBIN*)buff;
+	TITLESBINENTRY*	entry=(TITLESBINENTRY*)(buff + sizeof(TITLESBIN));
+	TITLESTRUCT		cur;
+	char*			strings;
+	u_long			left;
+	int				i,count;
+	
+	// Each part is checked against what is left so huge counts can't wrap
+	if ((b < (int)sizeof(TITLESBIN)) || (head->Version != TITLESBIN_VERSION)) {
+		printf("Bad compiled title list\n");
+		return false;
 	}
+	left = b - sizeof(TITLESBIN);
+	if ((head->Count > (left / sizeof(TITLESBINENTRY))) ||
+		(head->Strings > (left - (head->Count * sizeof(TITLESBINENTRY))))) {
+		printf("Bad compiled title list\n");
+		return false;
+	}
+	strings = (char*)(entry + head->Count);
+	TitleSrc.Kind = TITLESRC_BIN;
+	TitleSrc.Strings = strings - buff;
 	
-	if (TransCount < 96) {
-		TransCount += 1;
-		return(1);
-	} else {
-		return(0);
+	count = head->Count;
+	if (count > MAX_TITLES) {
+		printf("More than %i titles, the rest are left out\n", MAX_TITLES);
+		count = MAX_TITLES;
+	}
+	
+	for (i=0; i<count; i++, entry++) {
+		if ((entry->Name >= head->Strings) || (entry->ExecFile >= head->Strings)) {
+			printf("Bad compiled title list\n");
+			return false;
+		}
+		memset(&cur, 0, sizeof(TITLESTRUCT));
+		strncpy(cur.Name, strings + entry->Name, 63);
+		cur.SectorStart = entry->SectorStart;
+		cur.SectorLength = entry->SectorLength;
+		TitleRoom(i);
+		TitleIndex[i].Offset = (char*)entry - buff;
+		TitleIndex[i].StackAddr = entry->StackAddr;
+		TitleStore(i, &cur, strings + entry->ExecFile);
 	}
 	
+	NumTitles = count;
+	return true;
+	
 }
 
-void PrepDisplay() {
+char* TitlesFile(char* titlefile) {
 	
-	ActiveBuffer = GsGetActiveBuff();
-	GsSetWorkBase((PACKET*)GPUPacketArea[ActiveBuffer]);
-	GsClearOt(0, 0, &myOT[ActiveBuffer]);
+	// Returns the compiled TITLES.BIN next to a TITLES.TXT if there is one
 	
-}
-void Display() {
+	CdlFILE	File;
+	int		len=strlen(titlefile);
 	
-	VSync(0);
-	GsSwapDispBuff();
-	GsSortClear(ClearRed, ClearGrn, ClearBlu, &myOT[ActiveBuffer]);
-	GsDrawOt(&myOT[ActiveBuffer]);
+	if ((len < 4) || (len >= sizeof(TitlesBinName))) return titlefile;
+	if ((strncmp(titlefile + len - 4, ".TXT", 4) != 0) && (strncmp(titlefile + len - 4, ".txt", 4) != 0)) {
+		return titlefile;
+	}
+	
+	strcpy(TitlesBinName, titlefile);
+	strcpy(TitlesBinName + len - 4, ".BIN");
+	
+	if (CdIndexFile(&File, TitlesBinName)) return TitlesBinName;
+	return titlefile;
 	
 }
-void DisplayNoClear() {
 
-	VSync(0);
-	GsSwapDispBuff();
-	GsDrawOt(&myOT[ActiveBuffer]);
+int TitlesBin(char* titlefile) {
+	
+	// True for the name of a compiled TITLES.BIN
+	
+	int	len=strlen(titlefile);
+	
+	if (len < 4) return false;
+	return (strncmp(titlefile + len - 4, ".BIN", 4) == 0) || (strncmp(titlefile + len - 4, ".bin", 4) == 0);
 	
 }
 
-u_long StartMusic (TITLESTRUCT* file, u_long currenttype, int PadStatus) {
-
-	StopMusic (currenttype);
-	if (file->StackAddr != currenttype) {
-		UnloadMusic(currenttype);
-		LoadMusic(file->StackAddr);
-	}
-	ChangeMusic(file, PadStatus);
-	return file->StackAddr;
+void IndexTitles() {
+	
+	// Resolve every file the current menu points to so the first selection of
+	// each entry does not have to search the disc directory. Only the paths
+	// of the decoded pages are known, big menus would have to be read again.
+	
+	int		i=0;
+	CdlFILE	File;
+	
+	for (i=1; i<PathCount; i+=1) {
+		if (PathName(i)[0] == '\\') {
+			CdIndexFile(&File, PathName(i));
+		}
+	}
+	
+	#if DEBUG
+	printf("Indexed %i files\n", CdIndexCount);
+	#endif
+	
+}
+
+void TitleSource(char* file, u_long ssect) {
+	
+	// Starts a new menu read from a list file, from sector ssect on. The
+	// pages of the previous menu are dropped, and the playlist with them.
+	
+	CdlFILE	File;
+	int		i;
+	
+	PlaylistClear();
+	strncpy(TitleSrc.File, file, sizeof(TitleSrc.File) - 1);
+	TitleSrc.File[sizeof(TitleSrc.File) - 1] = 0;
+	TitleSrc.Ssect = ssect;
+	TitleSrc.Lba = -1;
+	if (CdIndexFile(&File, TitleSrc.File)) {
+		TitleSrc.Lba = CdPosToInt(&File.pos) + ssect;
+	}
+	TitleSrc.Size = 0;
+	TitleSrc.Strings = 0;
+	TitleSrc.Record = 0;
+	
+	for (i=0; i<TITLE_SECTORS; i++) {
+		TitleSrc.Sector[i] = -1;
+	}
+	for (i=0; i<TITLE_PAGES; i++) {
+		TitlePage[i] = -1;
+	}
+	PathClear();
+	memset(TitleDaSet, 0, sizeof(TitleDaSet));
+	NumTitles = 0;
+	MenuPf.Next = 0;
+	TitleKeys = 0;
+	TitleSorted = false;
+	FilterLen = 0;
+	
+}
+
+TITLESTRUCT* TitleAt(int title) {
+	
+	// Returns an entry of the menu, decoding its page again from the list
+	// file if it was dropped. Entries outside the menu are blank.
+	
+	TITLESTRUCT*	entry=TitlePeek(title);
+	
+	if (entry == 0) {
+		TitleFill(title - (title % TITLE_PAGESIZE), TitleVictim(-1));
+		entry = TitlePeek(title);
+	}
+	
+	return entry;
+	
+}
+
+TITLESTRUCT* TitlePeek(int title) {
+	
+	// Returns an entry if its page is decoded, 0 if it isn't
+	
+	int	page;
+	
+	if ((title < 0) || (title >= NumTitles)) return &TitleNone;
+	
+	page = TitleFind(title);
+	if (page < 0) return 0;
+	
+	TitleLast = page;
+	return TitleData + (page * TITLE_PAGESIZE) + (title % TITLE_PAGESIZE);
+	
+}
+
+int TitleFind(int title) {
+	
+	// Returns the page holding an entry, -1 if none does
+	
+	int	first=title - (title % TITLE_PAGESIZE);
+	int	i;
+	
+	if (TitlePage[TitleLast] == first) return TitleLast;
+	
+	for (i=0; i<TITLE_PAGES; i++) {
+		if (TitlePage[i] == first) return i;
+	}
+	
+	return -1;
+	
+}
+
+int TitleVictim(int first) {
+	
+	// Picks the page to reuse: an unused one, otherwise the one furthest from
+	// the cursor. For read ahead (first >= 0) the page has to be further away
+	// than the one being read, or -1 is returned. The page handed out last is
+	// never picked so two entries can be compared.
+	
+	int	sel=SelTitle - (SelTitle % TITLE_PAGESIZE);
+	int	i,dist,far=-1,fardist=-1;
+	
+	for (i=0; i<TITLE_PAGES; i++) {
+		if (TitlePage[i] < 0) return i;
+		if (i == TitleLast) continue;
+		dist = TitlePage[i] - sel;
+		if (dist < 0) dist = -dist;
+		if (dist > fardist) {
+			far = i;
+			fardist = dist;
+		}
+	}
+	
+	if (first >= 0) {
+		dist = first - sel;
+		if (dist < 0) dist = -dist;
+		if (fardist <= dist) return -1;
+	}
+	
+	return far;
+	
+}
+
+void TitleStore(int title, TITLESTRUCT* entry, char* path) {
+	
+	// Puts an entry being decoded in its page, taking an unused page for it
+	// if there is one. The stack address comes from the index as it can be
+	// changed from the menu.
+	
+	int	page=TitleFind(title);
+	
+	if (title == TitleKeys) {
+		TitleKey[TitleKeys++] = (TitleKeyName(entry->Name) << TITLEKEY_SHIFT) | title;
+	}
+	
+	if (page < 0) {
+		for (page=0; page<TITLE_PAGES; page++) {
+			if (TitlePage[page] < 0) break;
+		}
+		if (page == TITLE_PAGES) return;
+		TitlePage[page] = title - (title % TITLE_PAGESIZE);
+		memset(TitleData + (page * TITLE_PAGESIZE), 0, TITLE_PAGESIZE * sizeof(TITLESTRUCT));
+	}
+	
+	entry->Path = PathId(path);
+	entry->StackAddr = TitleIndex[title].StackAddr;
+	TitleKind(entry);
+	memcpy(TitleData + (page * TITLE_PAGESIZE) + (title % TITLE_PAGESIZE), entry, sizeof(TITLESTRUCT));
+	
+}
+
+void TitleFill(int first, int page) {
+	
+	// Decodes the page of entries starting at first into page, reading them
+	// from the list file. Entries that can't be read are left blank.
+	
+	TITLESTRUCT*	entry=TitleData + (page * TITLE_PAGESIZE);
+	TITLEPARSE		tp;
+	TITLESBINENTRY	bin;
+	VFSFILE			vfs;
+	VFSFILE2		vfs2;
+	char			path[52];
+	char*			buff;
+	int				i,len,count;
+	
+	// Keep stack addresses changed from the menu
+	if (TitlePage[page] >= 0) {
+		for (i=0; (i<TITLE_PAGESIZE) && ((TitlePage[page] + i) < NumTitles); i++) {
+			TitleIndex[TitlePage[page] + i].StackAddr = entry[i].StackAddr;
+		}
+	}
+	
+	TitlePage[page] = first;
+	count = NumTitles - first;
+	if (count > TITLE_PAGESIZE) count = TITLE_PAGESIZE;
+	
+	memset(entry, 0, TITLE_PAGESIZE * sizeof(TITLESTRUCT));
+	for (i=0; i<count; i++) {
+		entry[i].StackAddr = TitleIndex[first + i].StackAddr;
+	}
+	
+	#if DEBUG
+	printf("Decoding titles %i-%i of %s\n", first, first + count - 1, TitleSrc.File);
+	#endif
+	
+	switch (TitleSrc.Kind) {
+		case TITLESRC_TXT:
+			ParseTitlesStart(&tp);
+			tp.TitleNum = first;
+			tp.Last = first + count;
+			tp.Refill = true;
+			tp.Pos = TitleIndex[first].Offset;
+			while (tp.Pos < TitleSrc.Size) {
+				buff = TitleSrcSector(tp.Pos >> 11);
+				if (buff == 0) break;
+				len = 2048 - (tp.Pos & 2047);
+				if (len > (TitleSrc.Size - tp.Pos)) len = TitleSrc.Size - tp.Pos;
+				if (ParseTitlesChunk(&tp, buff + (tp.Pos & 2047), len) == false) break;
+			}
+			break;
+		case TITLESRC_BIN:
+			for (i=0; i<count; i++) {
+				if (TitleSrcCopy((char*)&bin, TitleIndex[first + i].Offset, sizeof(TITLESBINENTRY)) == false) break;
+				TitleSrcCopy(entry[i].Name, TitleSrc.Strings + bin.Name, 63);
+				memset(path, 0, sizeof(path));
+				TitleSrcCopy(path, TitleSrc.Strings + bin.ExecFile, 51);
+				entry[i].Path = PathId(path);
+				entry[i].SectorStart = bin.SectorStart;
+				entry[i].SectorLength = bin.SectorLength;
+			}
+			break;
+		case TITLESRC_VFS:
+			for (i=0; i<count; i++) {
+				if (TitleSrc.Record == sizeof(VFSFILE2)) {
+					if (TitleSrcCopy((char*)&vfs2, TitleIndex[first + i].Offset, sizeof(VFSFILE2)) == false) break;
+					VfsEntry2(&entry[i], &vfs2);
+				} else {
+					if (TitleSrcCopy((char*)&vfs, TitleIndex[first + i].Offset, sizeof(VFSFILE)) == false) break;
+					VfsEntry(&entry[i], &vfs);
+				}
+				entry[i].StackAddr = TitleIndex[first + i].StackAddr;
+			}
+			break;
+	}
+	
+	// The track of entries set to CD audio isn't in the list file
+	for (i=0; i<count; i++) {
+		if (TitleDaSet[(first + i) >> 3] & (1 << ((first + i) & 7))) {
+			entry[i].Path = PathId("00000002");
+		}
+		TitleKind(&entry[i]);
+	}
+	
+}
+
+void TitleRefill() {
+	
+	// Decodes one of the pages around the cursor that isn't decoded yet,
+	// nearest first. Waits while a background read has the drive.
+	
+	int	sel=SelTitle - (SelTitle % TITLE_PAGESIZE);
+	int	i,j,first,page;
+	
+	if (NumTitles <= (TITLE_PAGES * TITLE_PAGESIZE)) return;
+	if (CdAsyncBusy()) return;
+	
+	// While filtering the entries on screen come from anywhere in the list,
+	// the pages of those around the cursor are kept and any other is reused
+	if (FilterLen > 0) {
+		for (i=0; i<(TITLE_PAGES - 1); i++) {
+			first = ViewEntry(ViewPos + (((i + 1) / 2) * ((i & 1) ? 1 : -1)));
+			if (first >= NumTitles) continue;
+			first -= first % TITLE_PAGESIZE;
+			if (TitleFind(first) >= 0) continue;
+			for (page=0; page<TITLE_PAGES; page++) {
+				if (TitlePage[page] < 0) break;
+				for (j=0; j<(TITLE_PAGES - 1); j++) {
+					sel = ViewEntry(ViewPos + (((j + 1) / 2) * ((j & 1) ? 1 : -1)));
+					if ((sel < NumTitles) && (TitlePage[page] == (sel - (sel % TITLE_PAGESIZE)))) break;
+				}
+				if (j == (TITLE_PAGES - 1)) break;
+			}
+			if (page < TITLE_PAGES) TitleFill(first, page);
+			return;
+		}
+		return;
+	}
+	
+	// The cursor's page, then the ones after and before it in turn
+	for (i=0; i<TITLE_PAGES; i++) {
+		first = sel + (((i + 1) / 2) * TITLE_PAGESIZE * ((i & 1) ? 1 : -1));
+		if ((first < 0) || (first >= NumTitles)) continue;
+		if (TitleFind(first) >= 0) continue;
+		page = TitleVictim(first);
+		if (page >= 0) TitleFill(first, page);
+		return;
+	}
+	
+}
+
+char* TitleSrcSector(int sect) {
+	
+	// Returns a sector of the list file, reading it if it isn't buffered. A
+	// background read is waited for instead of being dropped.
+	
+	CdlLOC	pos;
+	char*	buff;
+	int		i;
+	
+	for (i=0; i<TITLE_SECTORS; i++) {
+		if (TitleSrc.Sector[i] == sect) return (char*)PAGEREAD_AREA + (i << 11);
+	}
+	if (TitleSrc.Lba < 0) return 0;
+	
+	i = TitleSrc.Next;
+	TitleSrc.Next = (i + 1) % TITLE_SECTORS;
+	TitleSrc.Sector[i] = -1;
+	buff = (char*)PAGEREAD_AREA + (i << 11);
+	
+	while (CdAsyncBusy());
+	
+	CdIntToPos(TitleSrc.Lba + sect, &pos);
+	CdTraceSetloc(&pos);
+	if ((CdTraceRead(TitleSrc.File, 1, (u_long*)buff, CdlModeSpeed, 0) == 0) || (CdReadSync(0, 0) < 0)) {
+		printf("Title list read failed: %s\n", TitleSrc.File);
+		return 0;
+	}
+	
+	TitleSrc.Sector[i] = sect;
+	return buff;
+	
+}
+
+int TitleSrcCopy(char* dest, u_long offset, int len) {
+	
+	// Copies len bytes from the list file, fewer if it ends first. Returns
+	// false if nothing could be read.
+	
+	char*	buff;
+	int		n;
+	
+	if (offset >= TitleSrc.Size) return false;
+	if (len > (TitleSrc.Size - offset)) len = TitleSrc.Size - offset;
+	
+	while (len > 0) {
+		buff = TitleSrcSector(offset >> 11);
+		if (buff == 0) return false;
+		n = 2048 - (offset & 2047);
+		if (n > len) n = len;
+		memcpy(dest, buff + (offset & 2047), n);
+		dest += n;
+		offset += n;
+		len -= n;
+	}
+	
+	return true;
+	
+}
+
+void VfsEntry(TITLESTRUCT* entry, VFSFILE* file) {
+	
+	// Decodes a VFS directory entry, the file is the VFS itself
+	
+	memset(entry, 0, sizeof(TITLESTRUCT));
+	entry->StackAddr = file->stack;
+	entry->SectorStart = file->addr;
+	entry->SectorLength = file->sector_size;
+	strncpy(entry->Name, file->name, 63);
+	entry->Path = PathId(TitleSrc.File);
+	
+}
+
+void VfsEntry2(TITLESTRUCT* entry, VFSFILE2* file) {
+	
+	// Decodes a VFS v2 directory entry. The type is given outright, only
+	// EXEs have a stack address of their own.
+	
+	memset(entry, 0, sizeof(TITLESTRUCT));
+	if ((file->type == SEP_MIN) || (file->type == SEQ_MIN) || (file->type == XA_MIN)) {
+		entry->StackAddr = file->type + file->sub;
+	} else if (file->type != 0) {
+		entry->StackAddr = file->type;
+	} else {
+		entry->StackAddr = file->stack;
+	}
+	entry->SectorStart = file->addr;
+	entry->SectorLength = file->sector_size;
+	entry->Xa = file->xa;
+	strncpy(entry->Name, file->name, 63);
+	entry->Path = PathId(TitleSrc.File);
+	
+}
+
+void PathClear() {
+	
+	// Empties the path table, ID 0 is always the empty path
+	
+	PathText[0] = 0;
+	PathOffset[0] = 0;
+	PathKey[0] = CdIndexHash("");
+	PathCount = 1;
+	PathSize = 1;
+	
+}
+
+u_short PathId(char* path) {
+	
+	// Returns the ID of a path, adding it to the table if it isn't there.
+	// Paths are cut to 51 characters like they were in the entries.
+	
+	char	name[52];
+	u_long	key;
+	int		i,len;
+	
+	strncpy(name, path, 51);
+	name[51] = 0;
+	key = CdIndexHash(name);
+	len = strlen(name) + 1;
+	
+	for (i=0; i<PathCount; i++) {
+		if ((PathKey[i] == key) && (strcmp(PathText + PathOffset[i], name) == 0)) return i;
+	}
+	
+	if ((PathCount == TITLEPATH_MAX) || ((PathSize + len) > TITLEPATH_TEXT)) {
+		PathCompact();
+		if ((PathCount == TITLEPATH_MAX) || ((PathSize + len) > TITLEPATH_TEXT)) {
+			printf("Path table full, %s left out\n", name);
+			return 0;
+		}
+	}
+	
+	memcpy(PathText + PathSize, name, len);
+	PathOffset[PathCount] = PathSize;
+	PathKey[PathCount] = key;
+	PathSize += len;
+	
+	return PathCount++;
+	
+}
+
+char* PathName(int id) {
+	
+	if ((id < 0) || (id >= PathCount)) return PathText;
+	return PathText + PathOffset[id];
+	
+}
+
+void PathCompact() {
+	
+	// Drops the paths no decoded entry uses any more. The paths left get new
+	// IDs, which the pages are updated to.
+	
+	u_char			used[TITLEPATH_MAX];
+	u_short			remap[TITLEPATH_MAX];
+	TITLESTRUCT*	entry;
+	int				i,j,len,count=0;
+	
+	memset(used, 0, sizeof(used));
+	used[0] = true;
+	for (i=0; i<(TITLE_PAGES * TITLE_PAGESIZE); i++) {
+		entry = TitleData + i;
+		if ((TitlePage[i / TITLE_PAGESIZE] >= 0) && (entry->Path < PathCount)) used[entry->Path] = true;
+	}
+	
+	// Offsets only ever grow with the ID so the text can be moved down in place
+	PathSize = 0;
+	for (i=0; i<PathCount; i++) {
+		remap[i] = 0;
+		if (used[i] == false) continue;
+		len = strlen(PathText + PathOffset[i]) + 1;
+		for (j=0; j<len; j++) {
+			PathText[PathSize + j] = PathText[PathOffset[i] + j];
+		}
+		PathOffset[count] = PathSize;
+		PathKey[count] = PathKey[i];
+		remap[i] = count++;
+		PathSize += len;
+	}
+	
+	for (i=0; i<(TITLE_PAGES * TITLE_PAGESIZE); i++) {
+		entry = TitleData + i;
+		entry->Path = (entry->Path < PathCount) ? remap[entry->Path] : 0;
+	}
+	TitleNone.Path = 0;
+	
+	#if DEBUG
+	printf("Path table compacted from %i to %i paths\n", PathCount, count);
+	#endif
+	PathCount = count;
+	
+}
+
+void TitleRoom(int title) {
+	
+	// Makes room in the index for an entry being added, dropping the cached
+	// lists in the way
+	
+	int	bytes=(title + 1) * sizeof(TITLEINDEX);
+	
+	if (bytes > MenuCacheLow) MenuCacheRoom(bytes);
+	
+}
+
+int MenuList(TITLESTRUCT* entry, MENULIST* list) {
+	
+	// Works out the list file a submenu entry opens, the same way the menu
+	// would be read. Returns false if it isn't on the disc.
+	
+	CdlFILE	File;
+	char*	name=PathName(entry->Path);
+	
+	memset(list, 0, sizeof(MENULIST));
+	list->Kind = TITLESRC_TXT;
+	list->Ssect = entry->SectorStart;
+	list->Nsect = entry->SectorLength;
+	if (entry->StackAddr == MENU_VFS) {
+		list->Kind = TITLESRC_VFS;
+		list->Ssect = 0;
+		list->Nsect = 0;
+	} else if (list->Nsect == 0) {
+		name = TitlesFile(name);
+	}
+	strncpy(list->File, name, sizeof(list->File) - 1);
+	
+	if (CdIndexFile(&File, list->File) == 0) return false;
+	list->Lba = CdPosToInt(&File.pos) + list->Ssect;
+	list->Size = (list->Nsect == 0) ? File.size : (list->Nsect << 11);
+	
+	return true;
+	
+}
+
+void MenuListSrc(MENULIST* list) {
+	
+	// Describes the list file of the current menu
+	
+	memset(list, 0, sizeof(MENULIST));
+	strcpy(list->File, TitleSrc.File);
+	list->Kind = (TitleSrc.Kind == TITLESRC_VFS) ? TITLESRC_VFS : TITLESRC_TXT;
+	list->Ssect = TitleSrc.Ssect;
+	list->Nsect = (TitleSrc.Ssect == 0) ? 0 : ((TitleSrc.Size + 2047) >> 11);
+	list->Lba = TitleSrc.Lba;
+	list->Size = TitleSrc.Size;
+	list->SelTitle = SelTitle;
+	
+}
+
+int MenuListSlot(MENULIST* list) {
+	
+	// Whether reading a list file takes slot 0. Long text lists are read a
+	// chunk at a time through the staging buffer and never do.
+	
+	if (list->Size <= MENU_STAGESIZE) return false;
+	return (list->Kind == TITLESRC_VFS) || TitlesBin(list->File);
+	
+}
+
+int MenuCacheFind(int lba) {
+	
+	int	i;
+	
+	if (lba < 0) return -1;
+	for (i=0; i<MenuCacheCount; i++) {
+		if (MenuCache[i].List.Lba == lba) return i;
+	}
+	
+	return -1;
+	
+}
+
+int MenuCacheOldest() {
+	
+	// Lists only read ahead go first, then the one opened longest ago
+	
+	int	i,old=0;
+	
+	for (i=1; i<MenuCacheCount; i++) {
+		if (MenuCache[i].Used < MenuCache[old].Used) old = i;
+	}
+	
+	return old;
+	
+}
+
+void MenuCacheDrop(int i) {
+	
+	// Lists are packed down from the top of the index in the order they were
+	// added, the ones below move up to close the gap
+	
+	u_long*	base=(u_long*)INDEX_AREA;
+	int		space=(MenuCache[i].Bytes + 3) >> 2;
+	int		j;
+	
+	for (j=(MenuCache[i].Offset >> 2) - 1; j>=(MenuCacheLow >> 2); j--) {
+		base[j + space] = base[j];
+	}
+	for (j=i+1; j<MenuCacheCount; j++) {
+		MenuCache[j].Offset += space << 2;
+		MenuCache[j - 1] = MenuCache[j];
+	}
+	
+	MenuCacheCount--;
+	MenuCacheLow += space << 2;
+	
+}
+
+int MenuCacheRoom(int bytes) {
+	
+	// Drops cached lists until the first bytes of the index are free of them
+	
+	while ((MenuCacheLow < bytes) && (MenuCacheCount > 0)) {
+		MenuCacheDrop(MenuCacheOldest());
+	}
+	
+	return (MenuCacheLow >= bytes);
+	
+}
+
+void MenuCacheAdd(MENULIST* list, char* buff, int bytes, int used) {
+	
+	// Keeps a list file read whole below the lists already kept. Only the
+	// part of the index the current menu doesn't use is taken. Lists too big
+	// to keep are still recorded so they aren't read ahead again.
+	
+	int	i=MenuCacheFind(list->Lba);
+	int	space;
+	
+	if (list->Lba < 0) return;
+	if (i >= 0) {
+		if (used) MenuCache[i].Used = ++MenuCacheClock;
+		return;
+	}
+	
+	if (bytes > MENUCACHE_MAXFILE) bytes = 0;
+	space = (bytes + 3) & ~3;
+	if (space > (MENUCACHE_SIZE - (NumTitles * sizeof(TITLEINDEX)))) {
+		bytes = 0;
+		space = 0;
+	}
+	
+	if (MenuCacheCount == MENUCACHE_MAX) MenuCacheDrop(MenuCacheOldest());
+	if (MenuCacheRoom((NumTitles * sizeof(TITLEINDEX)) + space) == false) return;
+	
+	i = MenuCacheCount++;
+	MenuCacheLow -= space;
+	MenuCache[i].List = *list;
+	MenuCache[i].Offset = MenuCacheLow;
+	MenuCache[i].Bytes = bytes;
+	MenuCache[i].Used = used ? ++MenuCacheClock : 0;
+	memcpy((char*)INDEX_AREA + MenuCacheLow, buff, bytes);
+	
+	#if DEBUG
+	printf("Menu cached: %s %i bytes, %i free\n", list->File, bytes, MenuCacheLow - (NumTitles * sizeof(TITLEINDEX)));
+	#endif
+	
+}
+
+void MenuCacheKeep(char* buff, int bytes) {
+	
+	// Keeps the list file of the menu just parsed from buff
+	
+	MENULIST	list;
+	
+	if (bytes <= 0) return;
+	MenuListSrc(&list);
+	list.Size = bytes;
+	MenuCacheAdd(&list, buff, bytes, true);
+	
+}
+
+void MenuLeave() {
+	
+	// Remembers the cursor of the current menu for when it is opened again
+	
+	int	i=MenuCacheFind(TitleSrc.Lba);
+	
+	if (i >= 0) MenuCache[i].List.SelTitle = SelTitle;
+	
+}
+
+int MenuOpen(int lba) {
+	
+	// Opens a menu from the cache. The list is copied out of the way first as
+	// the new index may need the space it takes. Returns false if the list
+	// isn't kept.
+	
+	MENUCACHE	cache;
+	int			i=MenuCacheFind(lba);
+	
+	if ((i < 0) || (MenuCache[i].Bytes == 0)) return false;
+	cache = MenuCache[i];
+	
+	// A read ahead in flight would land on the copy
+	if (MenuPf.Handle) {
+		CdAsyncCancel(MenuPf.Handle);
+		MenuPf.Handle = 0;
+	}
+	memcpy((char*)MENU_SCRATCH, (char*)INDEX_AREA + cache.Offset, cache.Bytes);
+	
+	if (cache.List.Kind == TITLESRC_VFS) {
+		ParseVfs(cache.List.File, (u_long*)MENU_SCRATCH);
+	} else {
+		TitleSource(cache.List.File, cache.List.Ssect);
+		ParseTitles((char*)MENU_SCRATCH, cache.Bytes);
+	}
+	MenuCacheAdd(&cache.List, (char*)MENU_SCRATCH, cache.Bytes, true);
+	SelTitle = (cache.List.SelTitle < NumTitles) ? cache.List.SelTitle : 0;
+	
+	#if DEBUG
+	printf("Menu opened from cache: %s\n", cache.List.File);
+	#endif
+	
+	return true;
+	
+}
+
+int MenuEnter(TITLESTRUCT* entry) {
+	
+	// Opens the submenu of an entry if it is cached, returns false if it has
+	// to be read
+	
+	MENULIST	list;
+	int			i;
+	
+	if (MenuList(entry, &list) == false) return false;
+	i = MenuCacheFind(list.Lba);
+	if ((i < 0) || (MenuCache[i].Bytes == 0)) return false;
+	
+	NavPush();
+	return MenuOpen(list.Lba);
+	
+}
+
+void NavPush() {
+	
+	// Remembers the current menu before another one is opened. The oldest
+	// menu is forgotten when the stack is full.
+	
+	int	i;
+	
+	MenuLeave();
+	if (NavDepth == NAV_DEPTH) {
+		for (i=1; i<NAV_DEPTH; i++) {
+			Nav[i - 1] = Nav[i];
+		}
+		NavDepth--;
+	}
+	MenuListSrc(&Nav[NavDepth++]);
+	
+}
+
+u_long MenuReturn(u_long MusType) {
+	
+	// Goes back a menu for Start. Menus no longer cached are read again, the
+	// music is only stopped for lists read to slot 0 or if it plays from the
+	// disc. Returns the music type left playing.
+	
+	if (MenuBack(false)) return MusType;
+	if (MenuListSlot(&Nav[NavDepth - 1]) || (MusType == MUSIC_XA) || (MusType == MUSIC_DA)) {
+		StopMusic(MusType);
+		UnloadMusic(MusType);
+		MusType = MUSIC_NONE;
+	}
+	MenuBack(true);
+	return MusType;
+	
+}
+
+int MenuBack(int disc) {
+	
+	// Goes back to the menu the current one was opened from, with the cursor
+	// where it was left. Menus that aren't cached are only read again if disc
+	// is true, otherwise false is returned. With nothing to go back to the
+	// cursor goes to the top.
+	
+	MENULIST*	list;
+	
+	if (NavDepth == 0) {
+		SelTitle = 0;
+		return true;
+	}
+	
+	list = &Nav[NavDepth - 1];
+	if (MenuOpen(list->Lba)) {
+		SelTitle = (list->SelTitle < NumTitles) ? list->SelTitle : 0;
+		NavDepth--;
+		return true;
+	}
+	if (disc == false) return false;
+	
+	NavDepth--;
+	CdAsyncCancel(0);
+	MenuPf.Handle = 0;
+	if (list->Kind == TITLESRC_VFS) {
+		InitVfs(list->File);
+	} else {
+		InitTitles(list->File, list->Ssect, list->Nsect);
+	}
+	SelTitle = (list->SelTitle < NumTitles) ? list->SelTitle : 0;
+	
+	return true;
+	
+}
+
+void MenuPrefetch(int start) {
+	
+	// Reads the submenus of the current menu into the cache while the drive
+	// isn't needed, one list at a time. Only entries already decoded are
+	// looked at. A read dropped for another one is simply forgotten.
+	
+	TITLESTRUCT*	entry;
+	u_long*			dir=(u_long*)MENU_SCRATCH;
+	int				bytes;
+	
+	if (MenuPf.Handle) {
+		switch (CdAsyncStatus(MenuPf.Handle)) {
+			case CDASYNC_BUSY:
+				return;
+			case CDASYNC_DONE:
+				bytes = MenuPf.List.Size;
+				if (MenuPf.List.Kind == TITLESRC_VFS) {
+					// Only as much of the pack as a directory may take was read
+					bytes = dir[2] << 11;
+					if (bytes > MenuPf.List.Size) bytes = MENUCACHE_MAXFILE + 1;
+				}
+				MenuCacheAdd(&MenuPf.List, (char*)MENU_SCRATCH, bytes, false);
+				break;
+		}
+		MenuPf.Handle = 0;
+	}
+	
+	if ((start == false) || CdAsyncBusy()) return;
+	
+	for (; MenuPf.Next<NumTitles; MenuPf.Next++) {
+		
+		entry = TitlePeek(MenuPf.Next);
+		if ((entry == 0) || ((entry->StackAddr != MENU_TXT) && (entry->StackAddr != MENU_VFS))) continue;
+		if (MenuList(entry, &MenuPf.List) == false) continue;
+		if ((MenuPf.List.Size <= 0) || (MenuCacheFind(MenuPf.List.Lba) >= 0)) continue;
+		
+		if (MenuPf.List.Size > MENUCACHE_MAXFILE) {
+			if (MenuPf.List.Kind == TITLESRC_TXT) {
+				MenuCacheAdd(&MenuPf.List, 0, MenuPf.List.Size, false);
+				continue;
+			}
+			MenuPf.List.Size = MENUCACHE_MAXFILE;
+		}
+		
+		MenuPf.Handle = CdAsyncRead(MenuPf.List.File, (u_long*)MENU_SCRATCH, MenuPf.List.Ssect, (MenuPf.List.Size + 2047) >> 11, 0);
+		if (MenuPf.Handle < 0) MenuPf.Handle = 0;
+		MenuPf.Next++;
+		return;
+		
+	}
+	
+}
+
+u_long TitleKeyName(char* name) {
+	
+	// Packs the first characters of a name into a key that sorts the same
+	// way regardless of case. Names that end early are padded with 0.
+	
+	u_long	key=0;
+	int		i,c;
+	
+	for (i=0; i<TITLEKEY_CHARS; i++) {
+		c = (u_char)*name;
+		if (c) name++;
+		if ((c >= 'a') && (c <= 'z')) c -= 'a' - 'A';
+		c = (c < ' ') ? 0 : (c - (' ' - 1));
+		if (c >= TITLEKEY_CODES) c = TITLEKEY_CODES - 1;
+		key = (key << TITLEKEY_BITS) | c;
+	}
+	
+	return key;
+	
+}
+
+int TitleKeyCode(u_long key, int pos) {
+	
+	// Character pos of a sorted key
+	
+	return (key >> (TITLEKEY_SHIFT + (TITLEKEY_BITS * (TITLEKEY_CHARS - 1 - pos)))) & (TITLEKEY_CODES - 1);
+	
+}
+
+void TitleSortKeys() {
+	
+	// Sorts the keys collected while the menu loaded and indexes them by
+	// first character. Only done once the menu is searched.
+	
+	u_long	key;
+	int		gap,i,j,c=0;
+	
+	if (TitleSorted) return;
+	
+	for (gap=1; gap<TitleKeys; gap=(gap * 3) + 1);
+	for (gap/=3; gap>0; gap/=3) {
+		for (i=gap; i<TitleKeys; i++) {
+			key = TitleKey[i];
+			for (j=i; (j >= gap) && (TitleKey[j - gap] > key); j-=gap) {
+				TitleKey[j] = TitleKey[j - gap];
+			}
+			TitleKey[j] = key;
+		}
+	}
+	
+	for (i=0; i<TitleKeys; i++) {
+		while (c <= TitleKeyCode(TitleKey[i], 0)) TitleFirst[c++] = i;
+	}
+	while (c <= TITLEKEY_CODES) TitleFirst[c++] = TitleKeys;
+	
+	TitleSorted = true;
+	
+}
+
+int TitleKeyBound(u_long prefix) {
+	
+	// Returns the first sorted key at or above a packed name prefix. Only the
+	// keys of its first character are searched.
+	
+	u_long	key=prefix << TITLEKEY_SHIFT;
+	int		c=prefix >> (TITLEKEY_BITS * (TITLEKEY_CHARS - 1));
+	int		lo,hi,mid;
+	
+	if (c >= TITLEKEY_CODES) return TitleKeys;
+	
+	lo = TitleFirst[c];
+	hi = TitleFirst[c + 1];
+	while (lo < hi) {
+		mid = (lo + hi) >> 1;
+		if (TitleKey[mid] < key) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	
+	return lo;
+	
+}
+
+void TitleJump(int dir) {
+	
+	// Moves the cursor to the first entry, in name order, of the next (or
+	// previous) first character used in the menu. Drops the filter. If the
+	// cursor's entry isn't decoded it isn't read for this, the jump goes to
+	// the first (or last) character instead.
+	
+	TITLESTRUCT*	entry=TitlePeek(SelTitle);
+	int				c;
+	
+	if (NumTitles == 0) return;
+	TitleSortKeys();
+	FilterLen = 0;
+	
+	if (entry != 0) {
+		c = TitleKeyName(entry->Name) >> (TITLEKEY_BITS * (TITLEKEY_CHARS - 1));
+	} else {
+		c = (dir > 0) ? -1 : TITLEKEY_CODES;
+	}
+	do {
+		c += dir;
+	} while ((c >= 0) && (c < TITLEKEY_CODES) && (TitleFirst[c] == TitleFirst[c + 1]));
+	if ((c < 0) || (c >= TITLEKEY_CODES)) return;
+	
+	SelTitle = TitleKey[TitleFirst[c]] & TITLEKEY_ENTRY;
+	
+}
+
+u_long FilterPrefix(int len) {
+	
+	// Packs the first len characters of the filter
+	
+	u_long	prefix=0;
+	int		i;
+	
+	for (i=0; i<TITLEKEY_CHARS; i++) {
+		prefix = (prefix << TITLEKEY_BITS) | ((i < len) ? FilterCode[i] : 0);
+	}
+	
+	return prefix;
+	
+}
+
+void FilterView() {
+	
+	// Narrows the list to the entries whose names start with the filter and
+	// puts the cursor on the first one
+	
+	u_long	prefix=FilterPrefix(FilterLen);
+	
+	ViewStart = TitleKeyBound(prefix);
+	ViewEnd = TitleKeyBound(prefix + (1 << (TITLEKEY_BITS * (TITLEKEY_CHARS - FilterLen))));
+	ViewPos = 0;
+	if ((FilterLen > 0) && (ViewEnd > ViewStart)) SelTitle = TitleKey[ViewStart] & TITLEKEY_ENTRY;
+	
+}
+
+int FilterAdd() {
+	
+	// Adds a character to the filter, the first one that follows it in the
+	// entries shown. Returns false if the filter can't be any longer.
+	
+	int	i,end;
+	
+	if (NumTitles == 0) return false;
+	if (FilterLen == TITLEKEY_CHARS) return false;
+	TitleSortKeys();
+	
+	end = TitleKeyBound(FilterPrefix(FilterLen) + (1 << (TITLEKEY_BITS * (TITLEKEY_CHARS - FilterLen))));
+	FilterCode[FilterLen] = 1;	// Skip the names that end here
+	i = TitleKeyBound(FilterPrefix(FilterLen + 1));
+	if (i >= end) return false;
+	
+	FilterCode[FilterLen] = TitleKeyCode(TitleKey[i], FilterLen);
+	FilterLen++;
+	FilterView();
+	
+	return true;
+	
+}
+
+int FilterStep(int dir) {
+	
+	// Changes the last character of the filter to the next (or previous) one
+	// any entry has there
+	
+	int		len=FilterLen - 1;
+	int		i,code;
+	u_long	prefix;
+	
+	if (FilterLen == 0) return false;
+	prefix = FilterPrefix(FilterLen);
+	
+	if (dir > 0) {
+		i = TitleKeyBound(prefix + (1 << (TITLEKEY_BITS * (TITLEKEY_CHARS - FilterLen))));
+		if (i >= TitleKeyBound(FilterPrefix(len) + (1 << (TITLEKEY_BITS * (TITLEKEY_CHARS - len))))) return false;
+	} else {
+		i = TitleKeyBound(prefix) - 1;
+		if (i < TitleKeyBound(FilterPrefix(len))) return false;
+	}
+	
+	code = TitleKeyCode(TitleKey[i], len);
+	if (code == 0) return false;
+	FilterCode[len] = code;
+	FilterView();
+	
+	return true;
+	
+}
+
+void FilterBack() {
+	
+	// Takes the last character off the filter, the cursor stays on its entry
+	
+	int	key=ViewStart + ViewPos;
+	
+	if (FilterLen == 0) return;
+	FilterLen--;
+	FilterView();
+	ViewPos = key - ViewStart;
+	
+}
+
+char* FilterName() {
+	
+	int	i;
+	
+	for (i=0; i<FilterLen; i++) {
+		FilterBuff[i] = FilterCode[i] + (' ' - 1);
+	}
+	FilterBuff[i] = 0;
+	
+	return FilterBuff;
+	
+}
+
+int ViewCount() {
+	
+	// Number of entries shown, all of them unless the list is filtered
+	
+	if (FilterLen == 0) return NumTitles;
+	return ViewEnd - ViewStart;
+	
+}
+
+int ViewEntry(int pos) {
+	
+	// Entry shown at a position of the list, NumTitles (a blank) if none
+	
+	if (FilterLen == 0) return pos;
+	if ((pos < 0) || (pos >= (ViewEnd - ViewStart))) return NumTitles;
+	return TitleKey[ViewStart + pos] & TITLEKEY_ENTRY;
+	
+}
+
+void ViewSelect(int pos) {
+	
+	ViewPos = pos;
+	SelTitle = ViewEntry(pos);
+	
+}
+
+int hex2int(char *string) {
+
+	// A tiny little function to convert a string of 8 hex characters
+	// into a 32-bit integer.
+	
+	int		i=0,r=0;
+	char	c=0;
+	
+	for (i=0; *(string+i) != 0x00; i+=1) {
+		
+		c=*(string+i);
+		if ((c >= 48) && (c <= 57)) {
+			r |= (c-48)<<(4*(7-i));
+		} else if ((c >= 65) && (c <= 70)) {
+			r |= (10+(c-65))<<(4*(7-i));
+		}
+		
+	}
+	
+	return(r);
+
+}
+float frand() {
+	
+	// Simplified random number generator
+	
+	return((float)rand() / 32767);
+	
+}
+
+int DoTransition() {
+	
+	// Simple transition effect routine (framebuffer based)
+	
+	RECT Box = { 0, 0, 640, 1 };
+	int BoxHeight=0;
+	int i=0;
+
+	if (TransCount) {
+		
+		for (i=0;i<15;i+=1) {
+			
+			if (TransCount > (2 * i)) {
+			
+				BoxHeight = TransCount - (2 * i);
+				
+				if (BoxHeight < 0)	BoxHeight = 0;
+				if (BoxHeight > 32)	BoxHeight = 32;
+				
+				if (BoxHeight > 0) {
+					Box.y = (32 * i) + BoxHeight;
+					ClearImage2(&Box, CLR_RED, CLR_GRN, CLR_BLU);
+				}
+			
+			}
+			
+		}
+		
+	}
+	
+	if (TransCount < 96) {
+		TransCount += 1;
+		return(1);
+	} else {
+		return(0);
+	}
+	
+}
+int DoTransition2() {
+	
+	// Simple transition effect routine
+	
+	GsBOXF Box = { 0, 0, 0, 640, 0, 0, 0, 0 };
+	int BoxHeight=0;
+	int i=0;
+
+	if (TransCount) {
+		
+		for (i=0;i<15;i+=1) {
+			
+			if (TransCount > (2 * i)) {
+			
+				BoxHeight = TransCount - (2 * i);
+				
+				if (BoxHeight < 0)	BoxHeight = 0;
+				if (BoxHeight > 32)	BoxHeight = 32;
+				
+				if (BoxHeight > 0) {
+					Box.y = (32 * i);
+					Box.h = BoxHeight;
+					GsSortBoxFill(&Box, &myOT[ActiveBuffer], 0);
+				}
+			
+			}
+			
+		}
+		
+	}
+	
+	if (TransCount < 96) {
+		TransCount += 1;
+		return(1);
+	} else {
+		return(0);
+	}
+	
+}
+
+void PrepDisplay() {
+	
+	ActiveBuffer = GsGetActiveBuff();
+	GsSetWorkBase((PACKET*)GPUPacketArea[ActiveBuffer]);
+	GsClearOt(0, 0, &myOT[ActiveBuffer]);
+	
+}
+void Display() {
+	
+	VSync(0);
+	GsSwapDispBuff();
+	GsSortClear(ClearRed, ClearGrn, ClearBlu, &myOT[ActiveBuffer]);
+	GsDrawOt(&myOT[ActiveBuffer]);
+	
+}
+void DisplayNoClear() {
+
+	VSync(0);
+	GsSwapDispBuff();
+	GsDrawOt(&myOT[ActiveBuffer]);
+	
+}
+
+u_long StartMusic (TITLESTRUCT* file, u_long currenttype, int PadStatus) {
+
+	MusicUse(file->StackAddr, currenttype);
+	ChangeMusic(file, PadStatus);
+	return file->StackAddr;
+
+}
+
+void MusicUse (u_long filetype, u_long currenttype) {
+
+	// Stops the music playing and gets the sound system ready for filetype,
+	// which is left as it is if it already is
+
+	StopMusic(currenttype);
+	if (filetype != currenttype) {
+		UnloadMusic(currenttype);
+	}
+	LoadMusic(filetype);
+
+}
+
+void TitleKind(TITLESTRUCT* entry) {
+	
+	// Works out what picking an entry does from its stack address. Done when
+	// it is decoded or changed so picking only has to look it up.
+	
+	u_long	addr=entry->StackAddr;
+	
+	entry->Sub = 0;
+	if ((addr >= SEP_MIN) && (addr <= SEP_MAX)) {
+		entry->Kind = KIND_SEP;
+		entry->Sub = addr - SEP_MIN;
+	} else if ((addr >= SEQ_MIN) && (addr <= SEQ_MAX)) {
+		entry->Kind = KIND_SEQ;
+		entry->Sub = addr - SEQ_MIN;
+	} else if ((addr >= XA_MIN) && (addr <= XA_MAX)) {
+		entry->Kind = KIND_XA;
+		entry->Sub = addr - XA_MIN;
+	} else switch (addr) {
+		case MUSIC_MOD:
+		case MUSIC_SEP:
+		case MUSIC_VAG:
+			entry->Kind = KIND_LOAD;
+			break;
+		case MUSIC_SEQ:
+			entry->Kind = KIND_SEQLOAD;
+			break;
+		case MENU_TXT:
+		case MENU_VFS:
+			entry->Kind = KIND_MENU;
+			break;
+		case MUSIC_NONE:
+		case MUSIC_DA:
+		case MUSIC_XA:
+			entry->Kind = KIND_PLAY;
+			break;
+		default:
+			entry->Kind = KIND_EXE;
+			break;
+	}
+	
+}
+
+int TitleSame(int title, int other) {
+	
+	// Returns true if two entries use the same data. title is usually LSMI,
+	// which may be out of the menu.
+	
+	TITLESTRUCT*	a;
+	TITLESTRUCT*	b;
+	
+	if ((title > MAX_TITLES) || (other > MAX_TITLES)) return false;
+	
+	// The page handed out last is kept, a stays valid
+	a = TitleAt(title);
+	b = TitleAt(other);
+	
+	return ((a->SectorStart == b->SectorStart) && (a->SectorLength == b->SectorLength) && (a->Path == b->Path));
+	
+}
+
+void PickExe(PICKSTRUCT* pick) {
+	
+	CancelLoad();
+	pick->Chosen = true;
+	TransCount = 0;
+	
+}
+
+void PickSep(PICKSTRUCT* pick) {
+	
+	// A track of the SEP playing only needs switching to
+	
+	if (TitleSame(LSMI, pick->Title)) {
+		#if DEBUG
+		printf("Multitrack correct, switching track to %i\n", TitleAt(pick->Title)->Sub);
+		#endif
+		CancelLoad();
+		curtrk = ChangeTrack(TitleAt(pick->Title)->Sub, MUSIC_SEP);
+	} else {
+		#if DEBUG
+		printf("Multitrack incorrect, switching track to %i\n", TitleAt(pick->Title)->Sub);
+		#endif
+		pick->MusType = BeginLoad(pick->Title, pick->PadStatus, pick->MusType);
+	}
+	
+}
+
+void PickSeq(PICKSTRUCT* pick) {
+	
+	// A track of the SEQ pack playing is switched to along with its
+	// parameters, unless square is held
+	
+	PARAMS_HEADER*	ParamPtr;
+	int				UseParams=((pick->PadStatus & PADRleft) == 0);
+	
+	if (TitleSame(LSMI, pick->Title) == false) {
+		#if DEBUG
+		printf("Multitrack incorrect. Switching track to %i\n", TitleAt(pick->Title)->Sub);
+		#endif
+		pick->MusType = BeginLoad(pick->Title, pick->PadStatus, pick->MusType);
+		return;
+	}
+	
+	#if DEBUG
+	printf("Multitrack correct. Switching track to %i\n", TitleAt(pick->Title)->Sub);
+	#endif
+	CancelLoad();
+	ParamPtr = ParamFile(TitleAt(pick->Title)->Sub, MusArea);
+	if (ParamPtr->Version != 0 && UseParams) {
+		LoadPreParams(ParamPtr);
+	}
+	curtrk = ChangeTrack(TitleAt(pick->Title)->Sub, MUSIC_SEQ);
+	if (ParamPtr->Version != 0 && UseParams) {
+		PickPostParams(pick, ParamPtr);
+	}
+	
+}
+
+void PickXa(PICKSTRUCT* pick) {
+	
+	// Channels of the XA file playing don't have to seek to it again
+	
+	int	same;
+	
+	CancelLoad();
+	same = TitleSame(LSMI, pick->Title);
+	if (pick->MusType != MUSIC_XA) {
+		MusicUse(MUSIC_XA, pick->MusType);
+		same = false;
+	}
+	LSMI = pick->Title;
+	LoadXA(PathName(TitleAt(pick->Title)->Path), TitleAt(pick->Title)->SectorStart, TitleAt(pick->Title)->Sub, (same == false), TitleAt(pick->Title)->Xa);
+	Music.State = MUSSTATE_OPEN;
+	pick->MusType = MUSIC_XA;
+	
+}
+
+void PickLoad(PICKSTRUCT* pick) {
+	
+	#if DEBUG
+	printf("loading: %s %i\n", PathName(TitleAt(pick->Title)->Path), TitleAt(pick->Title)->StackAddr);
+	#endif
+	pick->MusType = BeginLoad(pick->Title, pick->PadStatus, pick->MusType);
+	
+}
+
+void PickMusic(PICKSTRUCT* pick) {
+	
+	#if DEBUG
+	printf("chosen: %s %i\n", PathName(TitleAt(pick->Title)->Path), TitleAt(pick->Title)->StackAddr);
+	#endif
+	CancelLoad();
+	if (pick->PadStatus & PADRleft) {
+		pick->MusType = StartMusic(TitleAt(pick->Title), pick->MusType, 0);
+	} else { 
+		pick->MusType = StartMusic(TitleAt(pick->Title), pick->MusType, 1);
+	}
+	pick->MusPlaying = true;
+	LSMI = MAX_TITLES + 1;
+	pick->Timeout = true;
+	
+}
+
+void PickParams(PICKSTRUCT* pick) {
+	
+	// Reloads the parameters of a SEQ, reading its file again unless it is
+	// the one playing
+	
+	PARAMS_HEADER*	ParamPtr;
+	
+	if (TitleAt(pick->Title)->Kind == KIND_SEQLOAD) {
+		CancelLoad();
+		SlotLoad(0, TitleAt(pick->Title));
+		ParamPtr = ParamFile(0, MusArea);
+		LSMI = MAX_TITLES + 1;
+	} else if (TitleSame(LSMI, pick->Title)) {
+		ParamPtr = ParamFile(TitleAt(pick->Title)->Sub, MusArea);
+		LSMI = pick->Title;
+	} else {
+		CancelLoad();
+		SlotLoad(0, TitleAt(pick->Title));
+		ParamPtr = ParamFile(TitleAt(pick->Title)->Sub, MusArea);
+		LSMI = pick->Title;
+	}
+	
+	if (ParamPtr->Version != 0) {
+		LoadPreParams(ParamPtr);
+		PickPostParams(pick, ParamPtr);
+	}
+	
+}
+
+void PickPostParams(PICKSTRUCT* pick, PARAMS_HEADER* ParamPtr) {
+	
+	// Reverb settings of a parameter file, applied once the music is set up
+	
+	ChangeFeedback(p.Rfeedback, pick->MusType);
+	ChangeDelay(p.Rdelay, pick->MusType);
+	if (LoadPostParams(ParamPtr) > 0) {
+		p.Rmode = ChangeRevMode(p.Rmode, pick->MusType);
+		pick->Timeout = true;
+	} else {
+		ChangeRVol(p.RvolL, p.RvolR, pick->MusType);
+		ChangeRDepth(p.RdepthL, p.RdepthR, pick->MusType);
+	}
+	
+}
+
+u_long BeginLoad (int title, int PadStatus, u_long MusType) {
+	
+	// Starts reading the title's data in the background so the menu keeps
+	// running while it loads. FinishLoad() is called by DoMenu once the read
+	// has landed. Music data goes to the idle load slot if it fits there so
+	// the current music keeps playing until the slots are swapped, otherwise
+	// the music is stopped first. Returns the music type to use meanwhile.
+	
+	MENULIST	list;
+	int			idle=MusSlot ^ 1;
+	int			bytes=0;
+	u_long		ssect=TitleAt(title)->SectorStart;
+	u_long		nsect=TitleAt(title)->SectorLength;
+	
+	CancelLoad();
+	
+	Load.Title = title;
+	Load.PadStatus = PadStatus;
+	Load.Stage = 0;
+	Load.Ready = false;
+	Load.Slot = -1;
+	Load.Type = MUSIC_NONE;
+	
+	switch (TitleAt(title)->StackAddr) {
+		case MENU_VFS:	// Header sector first, the rest once its size is known
+			ssect = 0;
+			nsect = 1;
+		case MENU_TXT:
+			LSMI = MAX_TITLES + 1;
+			// Menus in the cache open right away and the music keeps playing.
+			// So it does while others are read, unless they are compiled
+			// lists too big to stage or it plays from the disc. The size of a
+			// VFS directory is only known from its header.
+			if (MenuEnter(TitleAt(title))) return MusType;
+			Load.Buff = (u_long*)MENU_STAGE;
+			list.Size = 0;
+			if (TitleAt(title)->StackAddr == MENU_TXT) MenuList(TitleAt(title), &list);
+			if ((MusType == MUSIC_XA) || (MusType == MUSIC_DA) || MenuListSlot(&list)) {
+				StopMusic(MusType);
+				UnloadMusic(MusType);
+				MusType = MUSIC_NONE;
+				Load.Buff = (u_long*)MenuStage(list.Size);
+			}
+			if (list.Size > MENU_STAGESIZE) {
+				// Too long to stage, text is parsed a chunk at a time as it
+				// comes in
+				NavPush();
+				SelTitle = 0;
+				InitTitles(list.File, list.Ssect, list.Nsect);
+				return MusType;
+			}
+			if ((TitleAt(title)->StackAddr == MENU_TXT) && (nsect == 0)) {
+				Load.Handle = CdAsyncRead(TitlesFile(PathName(TitleAt(title)->Path)), Load.Buff, ssect, nsect, 0);
+			} else {
+				Load.Handle = CdAsyncRead(PathName(TitleAt(title)->Path), Load.Buff, ssect, nsect, 0);
+			}
+			if (Load.Handle < 0) Load.Handle = 0;
+			return MusType;
+	}
+	
+	// Already in the idle slot (or on its way there), swap once it's done
+	if (SlotHas(idle, title) && (SlotPoll(idle) != CDASYNC_IDLE)) {
+		#if DEBUG
+		printf("%s is resident in slot %i\n", Slot[idle].File, idle);
+		#endif
+		Load.Slot = idle;
+		Load.Handle = Slot[idle].Handle;
+		Load.Ready = Slot[idle].Ready;
+		return MusType;
+	}
+	
+	// Read into the idle slot while the current music keeps playing
+	bytes = EntryBytes(TitleAt(title));
+	if ((bytes > 0) && (bytes <= Slot[idle].Size)) {
+		Load.Slot = idle;
+		Load.Handle = SlotRead(idle, title);
+		return MusType;
+	}
+	
+	// Only packs can go in with their VB left on the disc, anything else
+	// too big for slot 0 leaves the music alone
+	if ((bytes > Slot[0].Size) && (IsPack(TitleAt(title)->StackAddr) == false)) {
+		printf("%s is too big to load\n", PathName(TitleAt(title)->Path));
+		return MusType;
+	}
+	
+	// Too big for the idle slot, stop and read into the biggest one
+	StopMusic(MusType);
+	Load.Type = MusType;
+	Load.Slot = 0;
+	LSMI = MAX_TITLES + 1;
+	if (bytes > Slot[0].Size) {
+		// Only fits with its VB left on the disc, read the rest right away
+		if (SlotLoadHead(0, TitleAt(title))) {
+			Load.Handle = LOAD_RESIDENT;
+			Load.Ready = true;
+		} else {
+			Load.Handle = 0;
+		}
+	} else {
+		Load.Handle = SlotRead(0, title);
+	}
+	
+	if (Load.Handle == 0) {
+		UnloadMusic(Load.Type);
+		Load.Type = MUSIC_NONE;
+	}
+	
+	return MUSIC_NONE;
+	
+}
+
+int LoadStatus () {
+	
+	// CdAsyncStatus() of the current load, resident data counts as done.
+	// Music loads follow their slot through reads of several parts.
+	
+	int	status;
+	
+	if (Load.Ready) return CDASYNC_DONE;
+	if (Load.Slot < 0) return CdAsyncStatus(Load.Handle);
+	
+	status = SlotPoll(Load.Slot);
+	if (status == CDASYNC_IDLE) return CDASYNC_ERROR;
+	if (Slot[Load.Slot].Handle != 0) Load.Handle = Slot[Load.Slot].Handle;
+	return status;
+	
+}
+
+int FinishLoad (u_long *MusType) {
+	
+	// Opens the data of a load started by BeginLoad(). Returns true if the
+	// reverb timeout has to be restarted.
+	
+	TITLESTRUCT*	file=TitleAt(Load.Title);
+	PARAMS_HEADER*	ParamPtr=&ParamsNull;
+	u_long			type=file->StackAddr;
+	int				sect=0;
+	int				UseParams=((Load.PadStatus & PADRleft) == 0);
+	int				RevTimeout=false;
+	
+	Load.Handle = 0;
+	Load.Ready = false;
+	
+	if (type == MENU_VFS) {
+		sect = Load.Buff[2];
+		if ((Load.Stage == 0) && (sect > 1)) {
+			// Header is in, now read the rest of the directory. One too big
+			// to stage goes to slot 0 with the music stopped.
+			Load.Stage = 1;
+			if ((sect << 11) > MENU_STAGESIZE) {
+				StopMusic(*MusType);
+				UnloadMusic(*MusType);
+				*MusType = MUSIC_NONE;
+				Load.Buff = (u_long*)MenuStage(sect << 11);
+				memcpy(Load.Buff, (u_long*)MENU_STAGE, 2048);
+			}
+			Load.Handle = CdAsyncRead(PathName(file->Path), Load.Buff + 512, 1, sect - 1, 0);
+			if (Load.Handle < 0) Load.Handle = 0;
+			return false;
+		}
+		sprintf(StringBuff, "%s", PathName(file->Path));
+		NavPush();
+		SelTitle = 0;
+		ParseVfs(StringBuff, Load.Buff);
+		MenuCacheKeep((char*)Load.Buff, sect << 11);
+		return false;
+	}
+	
+	if (type == MENU_TXT) {
+		NavPush();
+		SelTitle = 0;
+		TitleSource((file->SectorLength == 0) ? TitlesFile(PathName(file->Path)) : PathName(file->Path), file->SectorStart);
+		ParseTitles((char*)Load.Buff, CdAsync.Bytes);
+		MenuCacheKeep((char*)Load.Buff, TitleSrc.Size);
+		return false;
+	}
+	
+	// Stop the music still playing from the other slot and swap
+	if (*MusType != MUSIC_NONE) {
+		StopMusic(*MusType);
+		Load.Type = *MusType;
+	}
+	Slot[Load.Slot].Ready = true;
+	MusSlot = Load.Slot;
+	MusArea = Slot[MusSlot].Addr;
+	LSMI = MAX_TITLES + 1;
+	
+	if ((type >= SEP_MIN) && (type <= SEP_MAX)) {
+		if (Load.Type != MUSIC_SEP) {
+			UnloadMusic(Load.Type);
+			LoadMusic(MUSIC_SEP);
+		}
+		*MusType = MUSIC_SEP;
+		OpenSep(MusArea, (short)(type - SEP_MIN));
+		Music.State = MUSSTATE_OPEN;
+		LSMI = Load.Title;
+	} else if ((type >= SEQ_MIN) && (type <= SEQ_MAX)) {
+		ParamPtr = ParamFile(type - SEQ_MIN, MusArea);
+		#if DEBUG
+			printf("Paramater Pointer: %p\n", ParamPtr);
+		#endif
+		if (ParamPtr->Version != 0 && UseParams) {
+			LoadPreParams(ParamPtr);
+		}
+		if (Load.Type != MUSIC_SEQ) {
+			UnloadMusic(Load.Type);
+			LoadMusic(MUSIC_SEQ);
+		}
+		*MusType = MUSIC_SEQ;
+		LoadSeq(MusArea, (short)(type - SEQ_MIN));
+		Music.State = MUSSTATE_OPEN;
+		if (ParamPtr->Version != 0 && UseParams) {
+			ChangeFeedback(p.Rfeedback, MUSIC_SEQ);
+			ChangeDelay(p.Rdelay, MUSIC_SEQ);
+			if (LoadPostParams(ParamPtr) > 0) {
+				p.Rmode = ChangeRevMode(p.Rmode, MUSIC_SEQ);
+				RevTimeout = true;
+			} else {
+				ChangeRVol(p.RvolL, p.RvolR, MUSIC_SEQ);
+				ChangeRDepth(p.RdepthL, p.RdepthR, MUSIC_SEQ);
+			}
+		}
+		LSMI = Load.Title;
+	} else {
+		if (Load.Type != type) {
+			UnloadMusic(Load.Type);
+			LoadMusic(type);
+		}
+		OpenMusic(file, UseParams);
+		*MusType = type;
+		RevTimeout = true;
+	}
+	
+	Load.Type = MUSIC_NONE;
+	return RevTimeout;
+	
+}
+
+void CancelLoad () {
+	
+	// Drops a background load along with the music system it was waiting on.
+	// A read into the idle slot is left running as a prefetch.
+	
+	if (Load.Handle == 0) return;
+	
+	if (Load.Type != MUSIC_NONE || Load.Slot < 0) {
+		CdAsyncCancel(Load.Handle);
+		if (Load.Slot >= 0) SlotDrop(Load.Slot);
+	}
+	UnloadMusic(Load.Type);
+	Load.Handle = 0;
+	Load.Ready = false;
+	Load.Type = MUSIC_NONE;
+	
+}
+
+void Prefetch (int title, u_long MusType) {
+	
+	// Starts reading an entry into the idle load slot once the cursor has
+	// rested on it for PREFETCH_FRAMES, so picking it only needs a slot swap.
+	// Moving to an entry outside the pack drops a read in flight.
+	
+	int	idle=MusSlot ^ 1;
+	int	bytes=0;
+	
+	SlotPoll(idle);
+	
+	if (title != Pf.Hover) {
+		Pf.Hover = title;
+		Pf.Frames = 0;
+		if (Slot[idle].Handle && !Slot[idle].Ready && ((TitlePeek(title) == 0) || !SlotHas(idle, title))) {
+			SlotDrop(idle);
+		}
+		return;
+	}
+	
+	if (Pf.Frames > PREFETCH_FRAMES) return;
+	if (++Pf.Frames <= PREFETCH_FRAMES) return;
+	
+	// Only plain music files and multitrack packs, and only while no XA or CD
+	// audio needs the drive
+	if ((MusType == MUSIC_XA) || (MusType == MUSIC_DA)) return;
+	if (!MusicNeedsData(TitleAt(title)->StackAddr) &&
+		!((TitleAt(title)->StackAddr >= SEP_MIN) && (TitleAt(title)->StackAddr <= SEQ_MAX))) return;
+	
+	// Resident in either slot already
+	if (SlotHas(idle, title)) return;
+	if (SlotHas(MusSlot, title) && (MusType != MUSIC_NONE)) return;
+	
+	bytes = EntryBytes(TitleAt(title));
+	if ((bytes == 0) || (bytes > Slot[idle].Size)) return;
+	
+	SlotRead(idle, title);
+	
+}
+
+int PlaylistMusic (TITLESTRUCT* entry) {
+	
+	// True for entries the playlist plays, music that comes to an end
+	
+	switch (entry->Kind) {
+		case KIND_SEP:
+		case KIND_SEQ:
+		case KIND_XA:
+		case KIND_SEQLOAD:
+			return true;
+		case KIND_LOAD:
+			return (entry->StackAddr == MUSIC_SEP);
+		case KIND_PLAY:
+			return (entry->StackAddr == MUSIC_XA) || (entry->StackAddr == MUSIC_DA);
+	}
+	return false;
+	
+}
+
+int PlaylistNext (int take) {
+	
+	// The entry to play once the music ends, -1 if there is none. Peeking
+	// (take false) only looks at decoded entries so no list file is read.
+	
+	TITLESTRUCT*	entry;
+	int				title;
+	int				i;
+	
+	if (Playlist.Count > 0) {
+		title = Playlist.Queue[Playlist.Head];
+		if (take) {
+			Playlist.Head = (Playlist.Head + 1) % PLAYLIST_MAX;
+			Playlist.Count--;
+		}
+		return title;
+	}
+	
+	if (Playlist.Current < 0) return -1;
+	for (i=1; i<=PLAYLIST_SCAN; i++) {
+		title = Playlist.Current + i;
+		if (title >= NumTitles) break;
+		entry = (take) ? TitleAt(title) : TitlePeek(title);
+		if (entry == 0) break;
+		if (PlaylistMusic(entry)) return title;
+	}
+	return -1;
+	
+}
+
+void PlaylistQueue (int title) {
+	
+	// Adds a music entry to the queue, which turns the playlist on
+	
+	if ((Playlist.Count == PLAYLIST_MAX) || (PlaylistMusic(TitleAt(title)) == false)) return;
+	Playlist.Queue[(Playlist.Head + Playlist.Count) % PLAYLIST_MAX] = title;
+	Playlist.Count++;
+	Playlist.On = true;
+	
+}
+
+void PlaylistClear () {
+	
+	Playlist.Current = -1;
+	Playlist.Head = 0;
+	Playlist.Count = 0;
+	
+}
+
+int MusicEnded (u_long filetype) {
+	
+	// True once the music open has played to its end. Right after it was
+	// picked it may not have started yet, so that isn't trusted.
+	
+	MUSICDRIVER* drv = MusicDriver(filetype);
+	
+	if ((Music.Driver != drv) || (Music.State != MUSSTATE_OPEN) || (drv->Ended == 0)) return false;
+	if (Playlist.Frames <= PREFETCH_FRAMES) return false;
+	return drv->Ended();
+	
+}
+
+int EntryBytes (TITLESTRUCT* file) {
+	
+	// Size of an entry's data rounded up to whole sectors, 0 if not found
+	
+	CdlFILE	File;
+	
+	if (file->SectorLength > 0) {
+		return file->SectorLength << 11;
+	}
+	if (CdIndexFile(&File, PathName(file->Path))) {
+		return (File.size + 2047) & ~2047;
+	}
+	return 0;
+	
+}
+
+int IsPack (u_long filetype) {
+	
+	// Types stored as QLPs with a VH/VB pair, which can have the VB streamed
+	
+	if ((filetype == MUSIC_SEQ) || (filetype == MUSIC_SEP)) return true;
+	return ((filetype >= SEP_MIN) && (filetype <= SEQ_MAX));
+	
+}
+
+int SlotRead (int slot, int title) {
+	
+	// Starts reading an entry into a load slot, returns the read handle or 0
+	
+	SlotDrop(slot);
+	
+	Slot[slot].Bytes = EntryBytes(TitleAt(title));
+	Slot[slot].SectorStart = TitleAt(title)->SectorStart;
+	Slot[slot].SectorLength = TitleAt(title)->SectorLength;
+	strncpy(Slot[slot].File, PathName(TitleAt(title)->Path), 52);
+	
+	// SEQ packs start with their directory, the rest follows in parts
+	if ((TitleAt(title)->StackAddr >= SEQ_MIN) && (TitleAt(title)->StackAddr <= SEQ_MAX)) {
+		Slot[slot].Seq = TitleAt(title)->StackAddr - SEQ_MIN;
+		Slot[slot].Files = -1;
+		Slot[slot].Handle = CdAsyncRead(PathName(TitleAt(title)->Path), Slot[slot].Addr, TitleAt(title)->SectorStart, 1, 0);
+	} else {
+		Slot[slot].Handle = CdAsyncRead(PathName(TitleAt(title)->Path), Slot[slot].Addr, TitleAt(title)->SectorStart, TitleAt(title)->SectorLength, 0);
+	}
+	if (Slot[slot].Handle < 0) {
+		SlotDrop(slot);
+	}
+	
+	return Slot[slot].Handle;
+	
+}
+
+int SlotPoll (int slot) {
+	
+	// Updates the state of a slot's read. Returns CDASYNC_DONE if the slot
+	// holds its whole entry, CDASYNC_BUSY while it's being read or
+	// CDASYNC_IDLE if it holds nothing usable.
+	
+	if (Slot[slot].File[0] == 0) return CDASYNC_IDLE;
+	if (Slot[slot].Ready) return CDASYNC_DONE;
+	
+	switch (CdAsyncStatus(Slot[slot].Handle)) {
+		case CDASYNC_BUSY:
+			return CDASYNC_BUSY;
+		case CDASYNC_DONE:
+			switch (SlotNextPart(slot)) {
+				case true:
+					return CDASYNC_BUSY;
+				case false:
+					break;
+				default:
+					SlotDrop(slot);
+					return CDASYNC_IDLE;
+			}
+			Slot[slot].Ready = true;
+			#if DEBUG
+			printf("Slot %i loaded %s\n", slot, Slot[slot].File);
+			#endif
+			return CDASYNC_DONE;
+		default:
+			SlotDrop(slot);
+			return CDASYNC_IDLE;
+	}
+	
+}
+
+int SlotPlan (int slot) {
+	
+	// Works out which sectors of a SEQ pack the slot's track needs from the
+	// directory: the track, the VH/VB pair and its parameter file, if any.
+	// Ranges close to each other are read as one. Returns false if the pack
+	// doesn't look like the usual tracks-VH-VB-parameters layout.
+	
+	QLPVIEW		view;
+	QLPFILE*	entry;
+	u_long*		addr=Slot[slot].Addr;
+	int			need[4];
+	int			i,n,count,vh;
+	int			first,last;
+	
+	// Only the directory is in, so the view is checked against the slot
+	// but no entry is looked into
+	if (!QLPview(&view, addr, Slot[slot].Size)) return false;
+	count = view.count;
+	vh = QLPfindExt(&view, "vh", 0);
+	if ((vh < 1) || ((vh + 1) >= count) || (Slot[slot].Seq >= vh)) return false;
+	
+	// Same order as in the pack, see ParamFile()
+	n = 0;
+	need[n++] = Slot[slot].Seq;
+	need[n++] = vh;
+	need[n++] = vh + 1;
+	if ((count - (vh + 2)) == 1) {
+		need[n++] = count - 1;
+	} else if ((vh + 2 + Slot[slot].Seq) < count) {
+		need[n++] = vh + 2 + Slot[slot].Seq;
+	}
+	
+	for (i=0; i<count; i++) {
+		Slot[slot].Have[i] = false;
+	}
+	Slot[slot].Files = count;
+	Slot[slot].Part = 0;
+	Slot[slot].Parts = 0;
+	
+	for (i=0; i<n; i++) {
+		entry = view.dir + need[i];
+		Slot[slot].Have[need[i]] = true;
+		first = (entry->addr << 2) >> 11;
+		last = ((entry->addr << 2) + entry->size + 2047) >> 11;
+		if (first == 0) first = 1;	// Directory sector is already in
+		if (last <= first) continue;
+		if ((Slot[slot].Parts > 0) &&
+			(first <= (Slot[slot].PartStart[Slot[slot].Parts - 1] + Slot[slot].PartLength[Slot[slot].Parts - 1] + PACK_MERGEGAP))) {
+			Slot[slot].PartLength[Slot[slot].Parts - 1] = last - Slot[slot].PartStart[Slot[slot].Parts - 1];
+			continue;
+		}
+		if (Slot[slot].Parts == PACK_MAXPARTS) return false;
+		Slot[slot].PartStart[Slot[slot].Parts] = first;
+		Slot[slot].PartLength[Slot[slot].Parts] = last - first;
+		Slot[slot].Parts++;
+	}
+	
+	#if DEBUG
+	printf("Reading %i files of %s in %i parts\n", n, Slot[slot].File, Slot[slot].Parts);
+	#endif
+	
+	return true;
+	
+}
+
+int SlotNextPart (int slot) {
+	
+	// Starts reading the next part of a partly read pack. Returns true if a
+	// read was started, false if there is nothing left to read or -1 if the
+	// read couldn't be started.
+	
+	int	sect;
+	
+	if (Slot[slot].Files < 0) {
+		if (SlotPlan(slot) == false) {
+			// Unusual layout, read the rest of the pack whole
+			Slot[slot].Files = 0;
+			Slot[slot].Part = 0;
+			Slot[slot].Parts = 0;
+			sect = Slot[slot].Bytes >> 11;
+			if (sect > 1) {
+				Slot[slot].PartStart[0] = 1;
+				Slot[slot].PartLength[0] = sect - 1;
+				Slot[slot].Parts = 1;
+			}
+		}
+	}
+	
+	if (Slot[slot].Part >= Slot[slot].Parts) return false;
+	
+	sect = Slot[slot].PartStart[Slot[slot].Part];
+	Slot[slot].Handle = CdAsyncRead(Slot[slot].File, Slot[slot].Addr + (sect << 9),
+		Slot[slot].SectorStart + sect, Slot[slot].PartLength[Slot[slot].Part], 0);
+	Slot[slot].Part++;
+	
+	if (Slot[slot].Handle < 0) return -1;
+	return true;
+	
+}
+
+void PackNeed (u_long* addr, int filenum) {
+	
+	// Reads a file of a partly read pack in place if it's not in yet
+	
+	QLPFILE	*entry;
+	int		i,first,last;
+	
+	for (i=0; i<2; i++) {
+		if ((Slot[i].Addr == addr) && (Slot[i].File[0] != 0)) break;
+	}
+	if (i == 2) return;
+	if ((Slot[i].Files <= 0) || (filenum < 0) || (filenum >= Slot[i].Files)) return;
+	if (Slot[i].Have[filenum]) return;
+	
+	entry = (QLPFILE*)(addr + 2) + filenum;
+	first = (entry->addr << 2) >> 11;
+	last = ((entry->addr << 2) + entry->size + 2047) >> 11;
+	
+	#if DEBUG
+	printf("Reading %s from %s\n", entry->name, Slot[i].File);
+	#endif
+	
+	// The sectors on either end may be shared with files already in, which
+	// are the same data so reading over them is harmless
+	if (CDRF(Slot[i].File, addr + (first << 9), Slot[i].SectorStart + first, last - first) < 0) return;
+	CdReadSync(0, 0);
+	Slot[i].Have[filenum] = true;
+	
+}
+
+int SlotLoad (int slot, TITLESTRUCT* file) {
+	
+	// Blocking read of an entry into a slot the music then plays from. Packs
+	// too big for the slot are read without their VB, which is streamed to
+	// SPU RAM when the pack is opened. Returns false on failure.
+	
+	int	bytes=EntryBytes(file);
+	
+	SlotUse(slot);
+	
+	if (bytes > Slot[slot].Size) {
+		if (IsPack(file->StackAddr)) {
+			return SlotLoadHead(slot, file);
+		}
+		printf("%s is too big to load (%i bytes)\n", PathName(file->Path), bytes);
+		return false;
+	}
+	
+	if (CDRF(PathName(file->Path), Slot[slot].Addr, file->SectorStart, file->SectorLength) < 0) {
+		return false;
+	}
+	CdReadSync(0, 0);
+	
+	return true;
+	
+}
+
+int SlotLoadHead (int slot, TITLESTRUCT* file) {
+	
+	// Reads a pack into a slot leaving out the VB. Everything up to the VB
+	// is read in place, everything after it is read right behind and the
+	// directory patched to match. Returns false on failure.
+	
+	CdlFILE		File;
+	QLPFILE*	entry;
+	u_long*		addr=Slot[slot].Addr;
+	int			i,count,vb;
+	int			headsect,tailsect,totalsect;
+	u_long		vboff,vbend,off;
+	
+	SlotDrop(slot);
+	
+	if (CdIndexFile(&File, PathName(file->Path)) == 0) {
+		printf("Pack not found: %s\n", PathName(file->Path));
+		return false;
+	}
+	totalsect = file->SectorLength;
+	if (totalsect == 0) {
+		totalsect = (File.size + 2047) >> 11;
+	}
+	
+	// Directory first, to find where the VB is
+	CDRF(PathName(file->Path), addr, file->SectorStart, 1);
+	CdReadSync(0, 0);
+	count = QLPfileCount(addr);
+	if ((count <= 0) || ((8 + (count * sizeof(QLPFILE))) > 2048)) {
+		printf("Bad pack directory: %s\n", PathName(file->Path));
+		return false;
+	}
+	
+	vb = PackVb(addr, file);
+	if (vb < 0) {
+		printf("No VB found in %s\n", PathName(file->Path));
+		return false;
+	}
+	
+	entry = (QLPFILE*)(addr + 2) + vb;
+	vboff = entry->addr << 2;
+	vbend = vboff + entry->size;
+	headsect = (vboff + 2047) >> 11;
+	tailsect = vbend >> 11;
+	
+	if (((headsect + (totalsect - tailsect)) << 11) > Slot[slot].Size) {
+		printf("%s is too big to load even without its VB\n", PathName(file->Path));
+		return false;
+	}
+	
+	CdBatchClear();
+	CdBatchAdd(PathName(file->Path), file->SectorStart, headsect, addr);
+	if (tailsect < totalsect) {
+		CdBatchAdd(PathName(file->Path), file->SectorStart + tailsect, totalsect - tailsect, addr + (headsect << 9));
+	}
+	if (CdBatchRun() < 0) {
+		return false;
+	}
+	
+	// Point the files behind the VB to where they ended up
+	for (i=0; i<count; i++) {
+		entry = (QLPFILE*)(addr + 2) + i;
+		off = entry->addr << 2;
+		if ((i != vb) && (off >= vbend)) {
+			entry->addr = (headsect << 9) + ((off - (tailsect << 11)) >> 2);
+		}
+	}
+	if (SeqPack.View.base == addr) {
+		SeqPack.View.base = 0;
+	}
+	
+	entry = (QLPFILE*)(addr + 2) + vb;
+	VbStream.Pack = addr;
+	VbStream.Vb = vb;
+	VbStream.Lba = CdPosToInt(&File.pos) + file->SectorStart + (vboff >> 11);
+	VbStream.Skip = vboff & 2047;
+	VbStream.Size = entry->size;
+	
+	#if DEBUG
+	printf("Loaded %s without its %i byte VB at LBA %i\n", PathName(file->Path), VbStream.Size, VbStream.Lba);
+	#endif
+	
+	Slot[slot].Handle = LOAD_RESIDENT;
+	Slot[slot].Ready = true;
+	Slot[slot].Bytes = (headsect + (totalsect - tailsect)) << 11;
+	Slot[slot].SectorStart = file->SectorStart;
+	Slot[slot].SectorLength = file->SectorLength;
+	strncpy(Slot[slot].File, PathName(file->Path), 52);
+	
+	return true;
+	
+}
+
+int PackVb (u_long* addr, TITLESTRUCT* file) {
+	
+	// Finds the VB of a pack from its directory, by position the same way
+	// OpenSep() and SeqView() do, -1 if there is none
+	
+	QLPVIEW*	view=&SeqPack.View;
+	int			count=QLPfileCount(addr);
+	int			vh=-1;
+	
+	if ((file->StackAddr == MUSIC_SEP) || ((file->StackAddr >= SEP_MIN) && (file->StackAddr <= SEP_MAX))) {
+		return (count > 2) ? 2 : -1;
+	}
+	
+	if (QLPview(view, addr, 0)) {
+		vh = QLPfindExt(view, "vh", 0);
+	}
+	view->base = 0;
+	if (vh < 0) {
+		if ((count >= 3) && (PackMagic(addr, file, count-3) == VH_MAGIC)) {
+			vh = count-3;
+		} else if (!(count & 1) && (PackMagic(addr, file, (count/2)-1) == VH_MAGIC)) {
+			vh = (count/2)-1;
+		} else {
+			vh = count-2;
+		}
+	}
+	if ((vh < 1) || ((vh + 1) >= count)) return -1;
+	
+	return vh + 1;
+	
+}
 
+u_long PackMagic (u_long* addr, TITLESTRUCT* file, int filenum) {
+	
+	// First word of a file in a pack of which only the directory is in,
+	// read from the disc to the sector after it
+	
+	u_long	off=((QLPFILE*)(addr + 2) + filenum)->addr << 2;
+	
+	if (off < 2048) return addr[off >> 2];
+	
+	CDRF(PathName(file->Path), addr + 512, file->SectorStart + (off >> 11), 1);
+	CdReadSync(0, 0);
+	
+	return addr[512 + ((off & 2047) >> 2)];
+	
+}
+
+void SlotDrop (int slot) {
+	
+	// Forgets what a slot holds, breaking off its read if still in flight
+	
+	if (Slot[slot].Handle > 0 && !Slot[slot].Ready) {
+		CdAsyncCancel(Slot[slot].Handle);
+	}
+	if (VbStream.Pack == Slot[slot].Addr) {
+		VbStream.Pack = 0;
+	}
+	if (SeqPack.View.base == Slot[slot].Addr) {
+		SeqPack.View.base = 0;
+	}
+	Slot[slot].Handle = 0;
+	Slot[slot].Ready = false;
+	Slot[slot].File[0] = 0;
+	Slot[slot].Files = 0;
+	Slot[slot].Parts = 0;
+	
+}
+
+void SlotUse (int slot) {
+	
+	// Empties a slot and plays music from it, for blocking reads
+	
+	SlotDrop(slot);
+	MusSlot = slot;
+	MusArea = Slot[slot].Addr;
+	
+}
+
+int SlotHas (int slot, int title) {
+	
+	// True if a load slot holds (or is reading) this entry's data
+	
+	if (Slot[slot].File[0] == 0) return false;
+	
+	return (TitleAt(title)->SectorStart == Slot[slot].SectorStart && TitleAt(title)->SectorLength == Slot[slot].SectorLength && strncmp(PathName(TitleAt(title)->Path), Slot[slot].File, 52) == 0);
+	
+}
+
+MUSICDRIVER* MusicDriver (u_long filetype) {
+	
+	// Backend of a music type, MusicNone for anything that isn't music
+	
+	if ((filetype < MUSIC_NONE) || (filetype >= (MUSIC_NONE + MUSIC_DRIVERS))) {
+		return &MusicNone;
+	}
+	return MusicDrivers[filetype - MUSIC_NONE];
+	
 }
 
 int StopMusic (u_long filetype) {
-	int loc[2] = {0};
+	MUSICDRIVER* drv = MusicDriver(filetype);
 	#if DEBUG
 	printf("Stopping music type %i\n", filetype);
 	#endif
+	// Nothing open, or already stopped
+	if ((Music.Driver == drv) && (Music.State < MUSSTATE_OPEN)) {
+		return 0;
+	}
+	if (drv->Stop) drv->Stop();
+	if (Music.Driver == drv) Music.State = MUSSTATE_READY;
+	return 0;
+
+}
+
+int ChangeMusic (TITLESTRUCT* file, int PadStatus) {
+	if (MusicNeedsData(file->StackAddr)) {
+		if (SlotLoad(0, file) == false) return -1;
+	}
+	return OpenMusic(file, PadStatus);
+}
+
+int MusicNeedsData (u_long filetype) {
+	// Types that have to be read into a load slot before they can be opened
 	switch (filetype) {
-		case MUSIC_NONE:
-			return 0;
 		case MUSIC_MOD:
-			MOD_Stop();
-			MOD_Free();
-			return 0;
 		case MUSIC_SEQ:
-			SsSeqClose (seq1);
-			SsVabClose (vab1);
-			SpuClearReverbWorkArea(p.Rmode);
-			return 0;
 		case MUSIC_SEP:
-			SsSepClose (sep1);
-			SsVabClose (vab1);
-			SpuClearReverbWorkArea(p.Rmode);
-			return 0;
 		case MUSIC_VAG:
-			SpuSetKey(SpuOff,SPU_0CH);
-			//SpuFlush(SPU_EVENT_ALL);
-			SpuFree(vag1);
-			return 0;
-		case MUSIC_DA:
-			CdPlay(0, loc, 0);
-			return 0;
-		case MUSIC_XA:
-			CdControlB(CdlPause, 0, 0);
-			return 0;
+			return true;
 		default:
-			return 1;
+			return false;
+	}
+}
+
+int OpenMusic (TITLESTRUCT* file, int PadStatus) {
+	MUSICDRIVER* drv = MusicDriver(file->StackAddr);
+	if (drv->Open == 0) {
+		return 0;
+	}
+	Music.State = MUSSTATE_OPEN;
+	return drv->Open(file, PadStatus);
+}
+
+// Backends, see MUSICDRIVER
+
+void SndInit() {
+	SoundOpen();
+	SoundTick(p.TickMode);
+	SoundSerial(false);
+}
+
+void SndQuit() {
+	SsUtAllKeyOff(0);
+}
+
+void SndRVol(short left, short right) {
+	SsSetRVol (left, right);
+}
+
+void SndRevMode(short mode) {
+	SramReverb(mode);
+	SsUtReverbOn();
+	SsUtSetReverbType(Sram.RevMode);
+}
+
+void SndRDepth(short left, short right) {
+	SsUtSetReverbDepth(left, right);
+}
+
+void SndDelay(short delay) {
+	SsUtSetReverbDelay(delay);
+}
+
+void SndFeedback(short feedback) {
+	SsUtSetReverbFeedback(feedback);
+}
+
+void SerialVol(short left, short right) {
+	SsSetSerialVol(SS_SERIAL_A, left, right);
+}
+
+void DiscPause() {
+	CdControlB(CdlPause, 0, 0);
+}
+
+void ModInit() {
+	SoundClose();
+	MOD_Init();
+}
+
+int ModOpen(TITLESTRUCT* file, int PadStatus) {
+	MOD_Load((u_char*)MusArea);
+	MOD_Start();
+	return 0;
+}
+
+void ModStop() {
+	MOD_Stop();
+	MOD_Free();
+}
+
+void ModPlay() {
+	MOD_Start();
+}
+
+void ModPause() {
+	MOD_Stop();
+}
+
+int SeqOpen(TITLESTRUCT* file, int PadStatus) {
+	PARAMS_HEADER* ParamPtr = ParamFile(0, MusArea);
+	#if DEBUG
+	printf("params load ver %hi\n", ParamPtr->Version);
+	#endif
+	if (ParamPtr->Version != 0 && PadStatus == 1) {
+		LoadPreParams(ParamPtr);
+	}
+	SsUtReverbOn();
+	LoadSeq(MusArea, 0);
+	if (ParamPtr->Version != 0 && PadStatus == 1) {
+		ChangeFeedback(p.Rfeedback, MUSIC_SEQ);
+		ChangeDelay(p.Rdelay, MUSIC_SEQ);
+		if (LoadPostParams(ParamPtr) > 0) {
+			p.Rmode = ChangeRevMode(p.Rmode, MUSIC_SEQ);
+			//Timeout = TimeoutStart;
+		} else {
+			ChangeRVol(p.RvolL, p.RvolR, MUSIC_SEQ);
+			ChangeRDepth(p.RdepthL, p.RdepthR, MUSIC_SEQ);
+		}
 	}
-	return 2;
+	return 0;
+}
+
+void SeqStop() {
+	SsSeqClose (seq1);
+	BankRelease (vab1);
+	SramReverbClear();
+}
+
+void SeqPlay() {
+	SsUtReverbOn();
+	SsSeqReplay(seq1);
+}
+
+void SeqPause() {
+	SsSeqPause(seq1);
+}
+
+void SeqTrack(short track) {
+	SsSeqClose (seq1);
+	PackNeed(MusArea, track);
+	seq1 = SsSeqOpen ((unsigned long*)QLPviewPtr(&SeqPack.View, track), vab1);
+	SsUtReverbOn();
+	SsSetMVol (p.MvolL, p.MvolR);
+	SsSeqSetVol (seq1, p.VolL, p.VolR);
+	SsSeqPlay(seq1, SSPLAY_PLAY, (short)p.SeqLoops);
+}
+
+void SeqVol(short left, short right) {
+	SsSeqSetVol (seq1, left, right);
+}
+
+int SeqEnded() {
+	return (SsIsEos(seq1, 0) == 0);
+}
+
+int SepOpen(TITLESTRUCT* file, int PadStatus) {
+	SsUtReverbOn();
+	return OpenSep(MusArea, 0);
+}
+
+void SepStop() {
+	SsSepClose (sep1);
+	BankRelease (vab1);
+	SramReverbClear();
+}
+
+void SepPlay() {
+	SsUtReverbOn();
+	SsSepReplay(sep1, curtrk);
+}
 
+void SepPause() {
+	SsSepPause(sep1, curtrk);
 }
 
-int ChangeMusic (TITLESTRUCT* file, int PadStatus) {
-	//int strackvol;
-	PARAMS_HEADER* ParamPtr = &ParamsNull;
+void SepTrack(short track) {
+	SsSepStop(sep1, curtrk);
+	SsUtReverbOn();
+	SsSepPlay(sep1, track, SSPLAY_PLAY, (short)p.SeqLoops);
+}
+
+void SepVol(short left, short right) {
+	SsSepSetVol (sep1, curtrk, left, right);
+}
+
+int SepEnded() {
+	return (SsIsEos(sep1, curtrk) == 0);
+}
+
+void VagInit() {
+	SpuCommonAttr cmn_attr;
+	SoundOpen();
+	SoundSerial(false);
+	cmn_attr.mask = (SPU_COMMON_MVOLL | SPU_COMMON_MVOLR);
+	cmn_attr.mvol.left = p.MvolL << 7;
+	cmn_attr.mvol.right = p.MvolR << 7;
+	SpuSetCommonAttr(&cmn_attr);
+	SpuSetIRQ(SPU_OFF);
+}
+
+void VagQuit() {
+	SpuSetReverbVoice(SPU_OFF, SPU_0CH);
+}
+
+int VagOpen(TITLESTRUCT* file, int PadStatus) {
 	SpuVoiceAttr voc_attr;
 	SpuReverbAttr rev_attr;
 	u_long d_size;
 	u_long s_rate;
-	int loc[2] = {0};
-		switch (file->StackAddr) {
-		case MUSIC_NONE:
-			return 0;
-		case MUSIC_MOD:
-			CDRF(file->ExecFile, (u_long*)MOD_AREA, file->SectorStart, file->SectorLength);
-			CdReadSync(0, 0);
-			MOD_Load((u_char*)MOD_AREA);
-			MOD_Start();
-			return 0;
-		case MUSIC_SEQ:
-			CDRF(file->ExecFile, (u_long*)MOD_AREA, file->SectorStart, file->SectorLength);
-			CdReadSync(0, 0);
-			ParamPtr = ParamFile(0, (u_long*)MOD_AREA);
-			#if DEBUG
-			printf("params load ver %hi\n", ParamPtr->Version);
-			#endif
-			if (ParamPtr->Version != 0 && PadStatus == 1) {
-				LoadPreParams(ParamPtr);
-			}
-			SsUtReverbOn();
-			LoadSeq((u_long*)MOD_AREA, 0, SeqParamCount((u_long*)MOD_AREA));
-			if (ParamPtr->Version != 0 && PadStatus == 1) {
-				ChangeFeedback(p.Rfeedback, MUSIC_SEQ);
-				ChangeDelay(p.Rdelay, MUSIC_SEQ);
-				if (LoadPostParams(ParamPtr) > 0) {
-					ChangeRevMode(p.Rmode, MUSIC_SEQ);
-					//Timeout = TimeoutStart;
-				} else {
-					ChangeRVol(p.RvolL, p.RvolR, MUSIC_SEQ);
-					ChangeRDepth(p.RdepthL, p.RdepthR, MUSIC_SEQ);
-				}			
-			}
-			return 0;
-		case MUSIC_SEP:
-			SsUtReverbOn();
-			return LoadSep(file->ExecFile, (u_long*)MOD_AREA, file->SectorStart, file->SectorLength, 0);
-		case MUSIC_VAG:
-			CDRF(file->ExecFile, (u_long*)MOD_AREA, file->SectorStart, file->SectorLength);
-			CdReadSync(0, 0);
-			SpuSetTransferMode(SpuTransByDMA);
-			d_size = *(u_long*)(MOD_AREA + 12);
-			s_rate = *(u_long*)(MOD_AREA + 16);
-			vag1 = SpuMalloc(SWAP_ENDIAN32(d_size));
-			SpuSetTransferStartAddr(vag1);
-			SpuWrite((u_char*)MOD_AREA + sizeof(VAGhdr), SWAP_ENDIAN32(d_size));
-			SpuIsTransferCompleted (SPU_TRANSFER_WAIT);	
-			voc_attr.mask =
-			(
-			  SPU_VOICE_VOLL |
-			  SPU_VOICE_VOLR |
-			  SPU_VOICE_PITCH |
-			  SPU_VOICE_WDSA |
-			  SPU_VOICE_ADSR_AMODE |
-			  SPU_VOICE_ADSR_SMODE |
-			  SPU_VOICE_ADSR_RMODE |
-			  SPU_VOICE_ADSR_AR |
-			  SPU_VOICE_ADSR_DR |
-			  SPU_VOICE_ADSR_SR |
-			  SPU_VOICE_ADSR_RR |
-			  SPU_VOICE_ADSR_SL
-			);
-			voc_attr.voice = SPU_0CH;
-			voc_attr.volume.left = p.VolL << 7;
-			voc_attr.volume.right = p.VolR << 7;
-			voc_attr.pitch = (SWAP_ENDIAN32(s_rate) << 12) / 44100L;
-			voc_attr.addr = vag1;
-			voc_attr.a_mode = SPU_VOICE_LINEARIncN;
-			voc_attr.s_mode = SPU_VOICE_LINEARIncN;
-			voc_attr.r_mode = SPU_VOICE_LINEARDecN;
-			voc_attr.ar = 0x0;
-			voc_attr.dr = 0x0;
-			voc_attr.rr = 0x0;
-			voc_attr.sr = 0x0;
-			voc_attr.sl = 0xf;
-			rev_attr.mask = (
-				SPU_REV_MODE |
-				SPU_REV_DEPTHL |
-				SPU_REV_DEPTHR |
-				SPU_REV_DELAYTIME |
-				SPU_REV_FEEDBACK
-			);
-			rev_attr.mode = p.Rmode;
-			rev_attr.depth.left = p.RdepthL << 7;
-			rev_attr.depth.right = p.RdepthR << 7;
-			rev_attr.delay = p.Rdelay;
-			rev_attr.feedback = p.Rfeedback;
-			SpuSetReverb(SPU_ON);
-			SpuSetReverbModeParam(&rev_attr);
-			SpuSetReverbVoice(SPU_ON, SPU_0CH);
-			SpuSetVoiceAttr(&voc_attr);
-			SpuSetKey(SpuOn,SPU_0CH);	
-			return 0;
-		case MUSIC_DA:
-			loc[0] = hex2int(file->ExecFile);
-			curtrk = loc[0] - 2;
-			CdPlay(1, loc, 0);
-			return 0;
-		case MUSIC_XA:
-			LoadXA(file->ExecFile, 0, true);
-			return 0;
-		default:
-			return 1;
+	SpuSetTransferMode(SpuTransByDMA);
+	d_size = *(u_long*)((u_char*)MusArea + 12);
+	s_rate = *(u_long*)((u_char*)MusArea + 16);
+	SramReverb(p.Rmode);
+	while ((vag1 = SramAlloc(SWAP_ENDIAN32(d_size), SRAM_VAG)) == 0) {
+		if (BankEvict() == false) {
+			printf("No room in SPU RAM for a %i byte VAG\n", SWAP_ENDIAN32(d_size));
+			return -1;
 		}
-	return -1;
+	}
+	#if DEBUG
+	SramDump();
+	#endif
+	SpuSetTransferStartAddr(vag1);
+	SpuWrite((u_char*)MusArea + sizeof(VAGhdr), SWAP_ENDIAN32(d_size));
+	SpuIsTransferCompleted (SPU_TRANSFER_WAIT);	
+	voc_attr.mask =
+	(
+	  SPU_VOICE_VOLL |
+	  SPU_VOICE_VOLR |
+	  SPU_VOICE_PITCH |
+	  SPU_VOICE_WDSA |
+	  SPU_VOICE_ADSR_AMODE |
+	  SPU_VOICE_ADSR_SMODE |
+	  SPU_VOICE_ADSR_RMODE |
+	  SPU_VOICE_ADSR_AR |
+	  SPU_VOICE_ADSR_DR |
+	  SPU_VOICE_ADSR_SR |
+	  SPU_VOICE_ADSR_RR |
+	  SPU_VOICE_ADSR_SL
+	);
+	voc_attr.voice = SPU_0CH;
+	voc_attr.volume.left = p.VolL << 7;
+	voc_attr.volume.right = p.VolR << 7;
+	voc_attr.pitch = (SWAP_ENDIAN32(s_rate) << 12) / 44100L;
+	voc_attr.addr = vag1;
+	voc_attr.a_mode = SPU_VOICE_LINEARIncN;
+	voc_attr.s_mode = SPU_VOICE_LINEARIncN;
+	voc_attr.r_mode = SPU_VOICE_LINEARDecN;
+	voc_attr.ar = 0x0;
+	voc_attr.dr = 0x0;
+	voc_attr.rr = 0x0;
+	voc_attr.sr = 0x0;
+	voc_attr.sl = 0xf;
+	rev_attr.mask = (
+		SPU_REV_MODE |
+		SPU_REV_DEPTHL |
+		SPU_REV_DEPTHR |
+		SPU_REV_DELAYTIME |
+		SPU_REV_FEEDBACK
+	);
+	rev_attr.mode = Sram.RevMode;
+	rev_attr.depth.left = p.RdepthL << 7;
+	rev_attr.depth.right = p.RdepthR << 7;
+	rev_attr.delay = p.Rdelay;
+	rev_attr.feedback = p.Rfeedback;
+	SpuSetReverb(SPU_ON);
+	SpuSetReverbModeParam(&rev_attr);
+	SpuSetReverbVoice(SPU_ON, SPU_0CH);
+	SpuSetVoiceAttr(&voc_attr);
+	SpuSetKey(SpuOn,SPU_0CH);
+	return 0;
+}
+
+void VagStop() {
+	SpuSetKey(SpuOff,SPU_0CH);
+	//SpuFlush(SPU_EVENT_ALL);
+	SramFree(vag1);
+}
+
+void VagVol(short left, short right) {
+	SpuSetVoiceVolume(SPU_0CH, left << 7, right << 7);
+}
+
+void VagRevMode(short mode) {
+	SramReverb(mode);
+	SpuSetReverbModeType(Sram.RevMode);
+	VagRDepth(p.RdepthL, p.RdepthR);
+}
+
+void VagRDepth(short left, short right) {
+	SpuReverbAttr rev_attr;
+	rev_attr.mask = (SPU_REV_DEPTHL | SPU_REV_DEPTHR);
+	rev_attr.depth.left = left << 7;
+	rev_attr.depth.right = right << 7;
+	SpuSetReverbDepth(&rev_attr);
+}
+
+void VagDelay(short delay) {
+	SpuSetReverbModeDelayTime(delay);
+}
+
+void VagFeedback(short feedback) {
+	SpuSetReverbModeFeedback(feedback);
+}
+
+void DaInit() {
+	u_char param[4];
+	//memset((u_char*)TEMP_AREA, 0, 400);
+	septrk = CdGetToc((CdlLOC*)CD_SCRATCH) - 1;
+	CdControl(CdlDemute, 0, 0);
+	CdControlB(CdlSetfilter, 0, 0);
+	CDReverbEnable();
+	param[0] = CdlModeDA;
+	CdControl(CdlSetmode, param, 0);
+}
+
+void DaQuit() {
+	u_char param[4] = {0};
+	CdControl(CdlSetmode, param, 0);
+	SoundSerial(false);
+}
+
+int DaOpen(TITLESTRUCT* file, int PadStatus) {
+	DaList[0] = hex2int(PathName(file->Path));
+	DaList[1] = 0;
+	curtrk = DaList[0] - 2;
+	CdPlay(1, DaList, 0);
+	return 0;
+}
+
+void DaStop() {
+	int loc[2] = {0};
+	CdPlay(0, loc, 0);
+}
+
+void DaPlay() {
+	u_char param[4] = {0};
+	u_char result[8] = {0};
+	CdControl(CdlGetlocP, param, result);
+	param[0] = result[5];
+	param[1] = result[6];
+	param[2] = result[7];
+	param[3] = result[0];
+	CdControl(CdlPlay, param, result);
+}
+
+void DaTrack(short track) {
+	DaList[0] = track + 2;
+	DaList[1] = 0;
+	CdPlay(1, DaList, 0);
+}
+
+int DaEnded() {
+	return (CdPlay(3, DaList, 0) < 0);
+}
+
+void XaInit() {
+	CdControl(CdlDemute, 0, 0);
+	Oldcallback = CdReadyCallback((CdlCB)cbready);
+	CDReverbEnable();
+}
+
+void XaQuit() {
+	u_char param[4] = {0};
+	CdControlB(CdlPause, 0, 0);
+	CdReadyCallback((void *)Oldcallback);
+	param[0] = CdlModeSpeed;
+	CdControlB(CdlSetmode, param, 0);
+	SoundSerial(false);
+}
+
+int XaOpen(TITLESTRUCT* file, int PadStatus) {
+	return LoadXA(PathName(file->Path), file->SectorStart, 0, true, file->Xa);
+}
+
+void XaPlay() {
+	u_char param[4] = {0};
+	u_char result[8] = {0};
+	CdControl(CdlGetlocP, param, result);
+	param[0] = result[5];
+	param[1] = result[6];
+	param[2] = result[7];
+	param[3] = result[0];
+	CdControl(CdlReadS, param, result);
+}
+
+void XaTrack(short track) {
+	LoadXA(0, 0, track, false, 0);
+}
+
+int XaEnded() {
+	return XaEnd;
 }
 
 char XASpeed(CdlLOC fp, XASECTOR* buf, int sect, u_char file, u_char channel) {
@@ -2261,8 +5724,8 @@ char XASpeed(CdlLOC fp, XASECTOR* buf, int sect, u_char file, u_char channel) {
 	int i;
 	septrk = 0;
 	while (second_pos == -1) {
-		CdControl(CdlSetloc, (u_char*)&fp, 0);
-		CdRead(sect, (u_long*)buf, CdlModeSpeed|CdlModeSize1);
+		CdTraceSetloc(&fp);
+		CdTraceRead("xa speed", sect, (u_long*)buf, CdlModeSpeed|CdlModeSize1, 0);
 		CdReadSync(0, 0);
 		for (i = 0; i < sect; i++) {
 			if (buf[i].channel > septrk) {
@@ -2311,7 +5774,7 @@ char XASpeed(CdlLOC fp, XASECTOR* buf, int sect, u_char file, u_char channel) {
 	return -1;
 }
 
-short LoadXA (char* name, short ptrack, int trackswitch) {
+short LoadXA (char* name, int ssect, short ptrack, int trackswitch, u_char xa) {
 	CdlFILE  loc;
 	CdlFILTER theFilter;
 	u_char param[4] = {0};
@@ -2319,18 +5782,28 @@ short LoadXA (char* name, short ptrack, int trackswitch) {
 	theFilter.file=1;
 	theFilter.chan=ptrack;
 	curtrk=ptrack;
+	XaEnd=false;
 	if (trackswitch) {
-		sprintf(StringBuff, "%s;1", name);
-		if (CdSearchFile(&loc, StringBuff) == 0) {
+		if (CdIndexFile(&loc, name) == 0) {
 			printf("XA file not found: %s\n", name);
 			return -1;
 		}
+		if (ssect > 0) {
+			CdIntToPos(CdPosToInt(&loc.pos) + ssect, &loc.pos);
+		}
 		XAPos = loc.pos;
-		cdspeed = XASpeed(loc.pos, (XASECTOR*)TEMP_AREA, 32, 1, ptrack);	
+		if (xa & XAINFO_KNOWN) {
+			// Known from the VFS, no need to sample the disc
+			cdspeed = (xa & XAINFO_2X) ? CdlModeSpeed : 0;
+			septrk = (xa & XAINFO_CHANS) + 1;
+		} else {
+			cdspeed = XASpeed(loc.pos, (XASECTOR*)CD_SCRATCH, XA_SAMPLESECTORS, 1, ptrack);
+		}
 	}
 	param[0] = cdspeed|CdlModeRT|CdlModeSF|CdlModeSize1;
 	CdControlF(CdlSetfilter, (u_char *)&theFilter);
 	CdControlB(CdlSetmode, param, 0);
+	CdTraceStream("xa", &XAPos);
 	CdControlF(CdlReadS, (u_char *)&XAPos);
 	return 0;
 }
@@ -2338,10 +5811,10 @@ short LoadXA (char* name, short ptrack, int trackswitch) {
 void cbready(int intr, u_char *result)
 {
 	int ID, currentChannel;
-	u_long *cAddress=(u_long *)TEMP_AREA;
+	u_long *cAddress=(u_long *)CD_SCRATCH;
 	if (intr == CdlDataReady)
 	{
-		CdGetSector((u_long *)TEMP_AREA,8);
+		CdGetSector((u_long *)CD_SCRATCH,8);
 		ID = *(unsigned short *)(cAddress+3);
 		// video sector channel number format = 1CCCCC0000000001
 		currentChannel = *((unsigned short *)(cAddress+3)+1);
@@ -2352,6 +5825,7 @@ void cbready(int intr, u_char *result)
 		if( (ID == 352) && (currentChannel == curtrk) )
 		{
 		    CdControlF(CdlPause,0);
+		    XaEnd = true;
 		    //SsSetSerialVol(SS_SERIAL_A,0,0);
 		}
 	}
@@ -2363,16 +5837,14 @@ void cbready(int intr, u_char *result)
 int LoadSep (char* name, u_long* addr, u_long ssect, u_long nsect, short ptrack) {
 	CDRF(name, addr, ssect, nsect);
 	CdReadSync(0, 0);
-	vab1 = SsVabOpenHead ((unsigned char*)QLPfilePtr(addr, 1), -1);
-	#if DEBUG
-		if( vab1 == -1 ) {
-			printf("Failed to open VH\n");
-		}
-	#endif
-	vab1 = SsVabTransBody ((unsigned char*)QLPfilePtr(addr, 2), vab1);
+	return OpenSep(addr, ptrack);
+}
+
+int OpenSep (u_long* addr, short ptrack) {
+	vab1 = BankOpen (addr, 1, 2);
 	#if DEBUG
 		if( vab1 == -1 ) {
-			printf("Failed to open VB\n");
+			printf("Failed to open VAB\n");
 		}
 	#endif
 	SsVabTransCompleted (SS_WAIT_COMPLETED);
@@ -2393,316 +5865,713 @@ int LoadSep (char* name, u_long* addr, u_long ssect, u_long nsect, short ptrack)
 		printf("SEP Track %hi Volume Set\n",curtrk);
 		#endif
 	}
-	curtrk = ptrack;
-	SsSepPlay(sep1, curtrk, SSPLAY_PLAY, (short)p.SeqLoops);
-	return 0;
+	curtrk = ptrack;
+	SsSepPlay(sep1, curtrk, SSPLAY_PLAY, (short)p.SeqLoops);
+	return 0;
+}
+
+short TransVab (u_long* addr, int vbnum, short vab) {
+	
+	// Sends a pack's VB to SPU RAM, from the disc if it was left there
+	
+	if ((VbStream.Pack == addr) && (VbStream.Vb == vbnum)) {
+		return StreamVab(vab);
+	}
+	
+	return SsVabTransBody ((unsigned char*)QLPfilePtr(addr, vbnum), vab);
+	
+}
+
+short StreamVab (short vab) {
+	
+	// Reads the VB described by VbStream into one half of the ring buffer
+	// while the other half is being transferred to SPU RAM. Every transfer
+	// but the last is a multiple of 64 bytes so the next one starts on a
+	// DMA block in SPU RAM, the bytes left over go with the next half.
+	
+	CdlLOC	pos;
+	u_char*	ring[2];
+	u_char*	data;
+	u_long	carry[16];
+	int		carried=0;
+	int		half=0;
+	int		lba=VbStream.Lba;
+	int		skip=VbStream.Skip;
+	int		left,sects,next=0;
+	u_long	todo=VbStream.Size;
+	u_long	chunk,avail;
+	short	ret=-2;
+	
+	ring[0] = (u_char*)VBSTREAM_AREA;
+	ring[1] = ring[0] + (VBSTREAM_SECTORS << 11);
+	
+	left = (skip + todo + 2047) >> 11;
+	sects = (left < VBSTREAM_SECTORS) ? left : VBSTREAM_SECTORS;
+	
+	CdAsyncCancel(0);
+	CdIntToPos(lba, &pos);
+	CdTraceSetloc(&pos);
+	CdTraceRead("vb", sects, (u_long*)ring[0], CdlModeSpeed, 0);
+	if (CdReadSync(0, 0) < 0) {
+		printf("VB read failed at LBA %i\n", lba);
+		return -1;
+	}
+	
+	while (todo > 0) {
+		
+		lba += sects;
+		left -= sects;
+		
+		// Next chunk in flight while this one goes to the SPU
+		if (left > 0) {
+			next = (left < VBSTREAM_SECTORS) ? left : VBSTREAM_SECTORS;
+			CdIntToPos(lba, &pos);
+			CdTraceSetloc(&pos);
+			CdTraceRead("vb", next, (u_long*)ring[half ^ 1], CdlModeSpeed, 0);
+		}
+		
+		data = ring[half] + skip;
+		avail = (sects << 11) - skip;
+		if (avail > todo) avail = todo;
+		skip = 0;
+		
+		// Fill up what was left over from the last half and send it first
+		if (carried > 0) {
+			chunk = 64 - carried;
+			if (chunk > avail) chunk = avail;
+			memcpy((u_char*)carry + carried, data, chunk);
+			carried += chunk;
+			data += chunk;
+			avail -= chunk;
+			todo -= chunk;
+			if ((carried == 64) || (todo == 0)) {
+				ret = SsVabTransBodyPartly((u_char*)carry, carried, vab);
+				SsVabTransCompleted (SS_WAIT_COMPLETED);
+				carried = 0;
+			}
+		}
+		
+		chunk = (avail < todo) ? (avail & ~63) : avail;
+		if (chunk > 0) {
+			ret = SsVabTransBodyPartly(data, chunk, vab);
+			SsVabTransCompleted (SS_WAIT_COMPLETED);
+		}
+		todo -= chunk;
+		
+		if (avail > chunk) {
+			carried = avail - chunk;
+			memcpy(carry, data + chunk, carried);
+			todo -= carried;
+		}
+		
+		if (left > 0) {
+			if (CdReadSync(0, 0) < 0 || ret == -1) {
+				printf("VB stream failed at LBA %i\n", lba);
+				CdReadBreak();
+				return -1;
+			}
+			sects = next;
+			half ^= 1;
+		}
+		
+	}
+	
+	#if DEBUG
+	printf("Streamed %i byte VB from LBA %i\n", VbStream.Size, VbStream.Lba);
+	#endif
+	
+	return (ret == -2) ? -1 : ret;
+	
+}
+
+u_long BankKey (u_char* vh, u_long vhsize, u_char* vb, u_long vbsize) {
+	
+	// FNV-1a of the VH, which holds every tone's VB offset, the start of the
+	// VB if it is in memory and the VB size
+	
+	u_long	h=0x811C9DC5;
+	u_long	i;
+	
+	for (i=0; i<vhsize; i++) {
+		h = (h ^ vh[i]) * 0x01000193;
+	}
+	for (i=0; (vb != 0) && (i < vbsize) && (i < BANK_VBHASH); i++) {
+		h = (h ^ vb[i]) * 0x01000193;
+	}
+	return (h ^ vbsize) * 0x01000193;
+	
+}
+
+short BankOpen (u_long* addr, int vhnum, int vbnum) {
+	
+	// Opens a pack's VAB, reusing a resident one with the same VH and VB.
+	// A VB left on the disc is told apart by where it is. Banks nothing plays
+	// from are dropped oldest first to make room. A VH too big for
+	// BANK_VHAREA is opened in place and not kept.
+	
+	BANKENTRY*	bank=0;
+	u_char*		vh=(u_char*)QLPfilePtr(addr, vhnum);
+	u_long		vhsize=((QLPFILE*)(addr + 2) + vhnum)->size;
+	u_long		vbsize=((QLPFILE*)(addr + 2) + vbnum)->size;
+	u_long		key;
+	u_char*		copy;
+	u_long		spu;
+	short		vab;
+	int			i;
+	
+	if ((VbStream.Pack == addr) && (VbStream.Vb == vbnum)) {
+		vbsize = VbStream.Size;
+		key = BankKey(vh, vhsize, 0, vbsize) ^ VbStream.Lba;
+	} else {
+		key = BankKey(vh, vhsize, (u_char*)QLPfilePtr(addr, vbnum), vbsize);
+	}
+	Banks.Stamp++;
+	
+	for (i=0; i<BANK_MAX; i++) {
+		bank = &Banks.Bank[i];
+		if ((bank->Vab >= 0) && bank->Kept && (bank->Key == key) && (bank->VhSize == vhsize) && (bank->VbSize == vbsize)) {
+			#if DEBUG
+			printf("VAB %hi still in SPU RAM, %i bytes not sent\n", bank->Vab, vbsize);
+			#endif
+			bank->Refs++;
+			bank->Used = Banks.Stamp;
+			return bank->Vab;
+		}
+	}
+	
+	// A free entry, room for the VB in SPU RAM and for the VH here
+	for (;;) {
+		bank = 0;
+		for (i=0; i<BANK_MAX; i++) {
+			if (Banks.Bank[i].Vab < 0) bank = &Banks.Bank[i];
+		}
+		if (bank != 0) break;
+		if (BankEvict() == false) return -1;
+	}
+	while ((spu = SramAlloc(vbsize, SRAM_VAB)) == 0) {
+		if (BankEvict() == false) {
+			printf("No room in SPU RAM for a %i byte VB\n", vbsize);
+			return -1;
+		}
+	}
+	copy = BankPlace(vhsize);
+	while ((copy == 0) && BankEvict()) {
+		copy = BankPlace(vhsize);
+	}
+	bank->Kept = (copy != 0);
+	if (copy != 0) {
+		memcpy(copy, vh, vhsize);
+	} else {
+		copy = vh;
+	}
+	
+	vab = SsVabOpenHeadSticky(copy, -1, spu);
+	if ((vab >= 0) && (TransVab(addr, vbnum, vab) < 0)) {
+		SsVabClose(vab);
+		vab = -1;
+	}
+	if (vab < 0) {
+		SramFree(spu);
+		return -1;
+	}
+	
+	bank->Vab = vab;
+	bank->Refs = 1;
+	bank->Key = key;
+	bank->Vh = copy;
+	bank->VhSize = vhsize;
+	bank->VbSize = vbsize;
+	bank->Spu = spu;
+	bank->Used = Banks.Stamp;
+	#if DEBUG
+	SramDump();
+	#endif
+	return vab;
+	
+}
+
+void BankRelease (short vab) {
+	
+	// Music stopped playing from a VAB, which stays in SPU RAM if it is kept
+	
+	BANKENTRY*	bank;
+	int			i;
+	
+	for (i=0; i<BANK_MAX; i++) {
+		bank = &Banks.Bank[i];
+		if (bank->Vab == vab) {
+			if (bank->Refs > 0) bank->Refs--;
+			if ((bank->Refs == 0) && (bank->Kept == false)) {
+				SsVabClose(bank->Vab);
+				SramFree(bank->Spu);
+				bank->Vab = -1;
+			}
+			return;
+		}
+	}
+	
+}
+
+int BankEvict () {
+	
+	// Closes the least recently used VAB nothing plays from
+	
+	BANKENTRY*	old=0;
+	int			i;
+	
+	for (i=0; i<BANK_MAX; i++) {
+		if ((Banks.Bank[i].Vab >= 0) && (Banks.Bank[i].Refs == 0)) {
+			if ((old == 0) || (Banks.Bank[i].Used < old->Used)) old = &Banks.Bank[i];
+		}
+	}
+	if (old == 0) return false;
+	
+	#if DEBUG
+	printf("Dropping VAB %hi, %i bytes\n", old->Vab, old->VbSize);
+	#endif
+	SsVabClose(old->Vab);
+	SramFree(old->Spu);
+	old->Vab = -1;
+	return true;
+	
+}
+
+int BankDropAt (u_long spu) {
+	
+	// Closes the VAB whose VB is at spu, if nothing plays from it
+	
+	int	i;
+	
+	for (i=0; i<BANK_MAX; i++) {
+		if ((Banks.Bank[i].Vab >= 0) && (Banks.Bank[i].Spu == spu) && (Banks.Bank[i].Refs == 0)) {
+			SsVabClose(Banks.Bank[i].Vab);
+			SramFree(spu);
+			Banks.Bank[i].Vab = -1;
+			return true;
+		}
+	}
+	return false;
+	
+}
+
+void BankFlush () {
+	
+	// Closes every resident VAB, for when SPU RAM is taken over
+	
+	int	i;
+	
+	for (i=0; i<BANK_MAX; i++) {
+		if (Banks.Bank[i].Vab >= 0) {
+			SsVabClose(Banks.Bank[i].Vab);
+			SramFree(Banks.Bank[i].Spu);
+		}
+		Banks.Bank[i].Vab = -1;
+		Banks.Bank[i].Refs = 0;
+	}
+	
+}
+
+u_char* BankPlace (u_long size) {
+	
+	// First gap in BANK_VHAREA that fits a VH, at the start of the area or
+	// right after one of the kept ones
+	
+	u_char*	start;
+	u_char*	end=(u_char*)BANK_VHAREA + BANK_VHSIZE;
+	int		i,j;
+	
+	size = (size + 3) & ~3;
+	for (i=-1; i<BANK_MAX; i++) {
+		if (i < 0) {
+			start = (u_char*)BANK_VHAREA;
+		} else if ((Banks.Bank[i].Vab >= 0) && Banks.Bank[i].Kept) {
+			start = Banks.Bank[i].Vh + ((Banks.Bank[i].VhSize + 3) & ~3);
+		} else {
+			continue;
+		}
+		if (start + size > end) continue;
+		for (j=0; j<BANK_MAX; j++) {
+			if ((Banks.Bank[j].Vab < 0) || (Banks.Bank[j].Kept == false)) continue;
+			if ((start < Banks.Bank[j].Vh + Banks.Bank[j].VhSize) && (Banks.Bank[j].Vh < start + size)) break;
+		}
+		if (j == BANK_MAX) return start;
+	}
+	return 0;
+	
+}
+
+void SramInit () {
+	
+	// Everything above the capture buffers is free but the smallest reverb
+	// work area
+	
+	Sram.Blocks = 2;
+	Sram.Block[0].Addr = SRAM_START;
+	Sram.Block[0].Size = SRAM_END - SRAM_START - SramRevSize[0];
+	Sram.Block[0].Kind = SRAM_FREE;
+	Sram.Block[1].Addr = SRAM_END - SramRevSize[0];
+	Sram.Block[1].Size = SramRevSize[0];
+	Sram.Block[1].Kind = SRAM_REVERB;
+	Sram.RevMode = 0;
+	SramReverbClear();
+	
+}
+
+u_long SramAlloc (u_long size, int kind) {
+	
+	// Places data in the free block it fits best. VBs are kept from the
+	// bottom and VAGs, which come and go, from the top, so one doesn't leave
+	// holes between the other. 0 if no block is big enough.
+	
+	SRAMBLOCK*	b;
+	int			best=-1;
+	int			i;
+	
+	size = (size + SRAM_ALIGN - 1) & ~(SRAM_ALIGN - 1);
+	for (i=0; i<Sram.Blocks; i++) {
+		b = &Sram.Block[i];
+		if ((b->Kind != SRAM_FREE) || (b->Size < size)) continue;
+		if ((best < 0) || (b->Size < Sram.Block[best].Size) || ((b->Size == Sram.Block[best].Size) && (kind == SRAM_VAG))) {
+			best = i;
+		}
+	}
+	if (best < 0) return 0;
+	
+	b = &Sram.Block[best];
+	if (b->Size == size) {
+		b->Kind = kind;
+		return b->Addr;
+	}
+	if (Sram.Blocks == SRAM_BLOCKS) return 0;
+	
+	// Split it, the free part staying on the side away from where kind goes
+	for (i=Sram.Blocks; i>best; i--) {
+		Sram.Block[i] = Sram.Block[i - 1];
+	}
+	Sram.Blocks++;
+	if (kind == SRAM_VAG) {
+		b->Size -= size;
+		b[1].Addr = b->Addr + b->Size;
+		b[1].Size = size;
+		b[1].Kind = kind;
+		return b[1].Addr;
+	}
+	b->Size = size;
+	b->Kind = kind;
+	b[1].Addr = b->Addr + size;
+	b[1].Size -= size;
+	return b->Addr;
+	
+}
+
+void SramFree (u_long addr) {
+	
+	// Frees a block, joining it with the free ones around it
+	
+	int	i,j;
+	
+	for (i=0; i<Sram.Blocks; i++) {
+		if ((Sram.Block[i].Addr == addr) && (Sram.Block[i].Kind != SRAM_REVERB)) break;
+	}
+	if (i == Sram.Blocks) return;
+	
+	Sram.Block[i].Kind = SRAM_FREE;
+	if ((i > 0) && (Sram.Block[i - 1].Kind == SRAM_FREE)) i--;
+	while ((i + 1 < Sram.Blocks) && (Sram.Block[i + 1].Kind == SRAM_FREE)) {
+		Sram.Block[i].Size += Sram.Block[i + 1].Size;
+		for (j=i+1; j<Sram.Blocks-1; j++) {
+			Sram.Block[j] = Sram.Block[j + 1];
+		}
+		Sram.Blocks--;
+	}
+	
+}
+
+int SramReverb (short mode) {
+	
+	// Sizes the reverb work area for mode and clears it. Growing it drops
+	// banks nothing plays from that are in the way, if music that is playing
+	// is, the mode in use is kept and false returned.
+	
+	SRAMBLOCK*	rev;
+	SRAMBLOCK*	below;
+	u_long		size;
+	int			i;
+	
+	if ((mode < 0) || (mode >= SRAM_REVMODES)) return false;
+	size = SramRevSize[mode];
+	rev = &Sram.Block[Sram.Blocks - 1];
+	
+	while (size > rev->Size) {
+		below = rev - 1;
+		if ((below->Kind == SRAM_FREE) && (below->Addr + size <= SRAM_END)) {
+			below->Size -= size - rev->Size;
+			if (below->Size == 0) {
+				*below = *rev;
+				Sram.Blocks--;
+				rev = below;
+			}
+			break;
+		}
+		
+		// Highest block in the way
+		for (i=Sram.Blocks-2; (i > 0) && (Sram.Block[i].Kind == SRAM_FREE); i--);
+		if ((Sram.Block[i].Kind != SRAM_VAB) || (BankDropAt(Sram.Block[i].Addr) == false)) {
+			#if DEBUG
+			printf("Reverb mode %hi would overwrite music, kept %hi\n", mode, Sram.RevMode);
+			#endif
+			SramReverbClear();
+			return false;
+		}
+		rev = &Sram.Block[Sram.Blocks - 1];
+	}
+	
+	if (size < rev->Size) {
+		below = rev - 1;
+		if (below->Kind == SRAM_FREE) {
+			below->Size += rev->Size - size;
+		} else if (Sram.Blocks < SRAM_BLOCKS) {
+			*(rev + 1) = *rev;
+			rev->Addr = below->Addr + below->Size;
+			rev->Size = (rev + 1)->Size - size;
+			rev->Kind = SRAM_FREE;
+			rev++;
+			Sram.Blocks++;
+		} else {
+			size = rev->Size;
+		}
+	}
+	rev->Addr = SRAM_END - size;
+	rev->Size = size;
+	Sram.RevMode = mode;
+	SramReverbClear();
+	return true;
+	
 }
 
-short LoadSeq (u_long* addr, short ptrack, int extfiles) {
-	//SeqParamCount (addr);
-	vab1 = SsVabOpenHead ((unsigned char*)QLPfilePtr(addr, (QLPfileCount(addr) - 2) - extfiles), -1);
-	#if DEBUG
-		if( vab1 == -1 ) {
-		printf("Failed to open VH!\n");
+void SramReverbClear () {
+	
+	SRAMBLOCK*	rev=&Sram.Block[Sram.Blocks - 1];
+	
+	SpuSetTransferStartAddr(rev->Addr);
+	SpuWrite0(rev->Size);
+	
+}
+
+void SramDump () {
+	
+	// Prints the SPU RAM map, for DEBUG builds
+	
+	char*	kind[4]={ "free", "VB", "VAG", "reverb" };
+	u_long	free=0;
+	u_long	largest=0;
+	int		i;
+	
+	printf("SPU RAM %05X-%05X, reverb mode %hi\n", SRAM_START, SRAM_END, Sram.RevMode);
+	for (i=0; i<Sram.Blocks; i++) {
+		printf("  %05X %6i %s\n", Sram.Block[i].Addr, Sram.Block[i].Size, kind[Sram.Block[i].Kind]);
+		if (Sram.Block[i].Kind == SRAM_FREE) {
+			free += Sram.Block[i].Size;
+			if (Sram.Block[i].Size > largest) largest = Sram.Block[i].Size;
 		}
-	#endif
-	vab1 = SsVabTransBody ((unsigned char*)QLPfilePtr(addr, (QLPfileCount(addr) - 1) - extfiles), vab1);
+	}
+	printf("  %i bytes free, %i in one block\n", free, largest);
+	
+}
+
+short LoadSeq (u_long* addr, short ptrack) {
+	SEQPACK* pack = SeqView(addr);
+	if (pack == 0) {
+		printf("No VH/VB in the SEQ pack\n");
+		return -1;
+	}
+	PackNeed(addr, pack->Vh);
+	vab1 = BankOpen (addr, pack->Vh, pack->Vh + 1);
 	#if DEBUG
 		if( vab1 == -1 ) {
-		printf("Failed to open VB!\n");
+		printf("Failed to open VAB!\n");
 		}
 	#endif
 	SsVabTransCompleted (SS_WAIT_COMPLETED);
 	SsStart2();
-	seq1 = SsSeqOpen ((unsigned long*)QLPfilePtr(addr, ptrack), vab1);
+	PackNeed(addr, ptrack);
+	seq1 = SsSeqOpen ((unsigned long*)QLPviewPtr(&pack->View, ptrack), vab1);
 	SsSetMVol (p.MvolL, p.MvolR);
 	SsSeqSetVol (seq1, p.VolL, p.VolR);
 	SsSeqPlay(seq1, SSPLAY_PLAY, (short)p.SeqLoops);
 	SsUtReverbOn();
-	septrk = (QLPfileCount(addr) - 2) - extfiles;
+	septrk = pack->Vh;
 	curtrk = ptrack;
 	#if DEBUG
-		printf("Tracks Total: %hi Track Selected: %hi File Count: %i\n", septrk, curtrk, QLPfileCount(addr));
+		printf("Tracks Total: %hi Track Selected: %hi File Count: %i\n", septrk, curtrk, pack->View.count);
 	#endif
 	return 0;
 }
 
 int UnloadMusic (u_long filetype) {
-	u_char param[4] = {0};
-	switch (filetype) {
-		case MUSIC_NONE:
-			return 0;
-		case MUSIC_MOD:
-			return 0;
-		case MUSIC_SEP:
-		case MUSIC_SEQ:
-			SsEnd();
-			SsQuit();
-			return 0;
-		case MUSIC_VAG:
-			SpuQuit();
-			return 0;
-		case MUSIC_DA:
-			CdControl(CdlSetmode, param, 0);
-			
-			SsEnd();
-			SsQuit();
-			SpuSetTransStartAddr(421887);
-			SpuWrite0(1024 * 100);
-
-			SpuQuit();
-			return 0;
-		case MUSIC_XA:
-			CdControlB(CdlPause, 0, 0);
-			CdReadyCallback((void *)Oldcallback);
-			param[0] = CdlModeSpeed;
-			CdControlB(CdlSetmode, param, 0);
-			return 0;
-		default:
-			return 1;
-		}
-	return 2;
+	MUSICDRIVER* drv = MusicDriver(filetype);
+	// Nothing of this type is set up
+	if ((Music.State == MUSSTATE_OFF) || (Music.Driver != drv)) {
+		return 0;
+	}
+	if (Music.State >= MUSSTATE_OPEN) StopMusic(filetype);
+	if (drv->Quit) drv->Quit();
+	Music.Driver = &MusicNone;
+	Music.State = MUSSTATE_OFF;
+	return 0;
 
 }
 
 int LoadMusic (u_long filetype) {
-	SpuCommonAttr cmn_attr;
-	u_char param[4];
-	switch (filetype) {
-		case MUSIC_NONE:
-			return 0;
-		case MUSIC_MOD:
-			MOD_Init();
-			return 0;
-		case MUSIC_SEQ:
-		case MUSIC_SEP:
-			SsInit();
-			SsSetTableSize (seq_table, 1, 16);
-			SsSetTickMode (p.TickMode);
-			return 0;
-		case MUSIC_VAG:
-			SpuInit();
-			SpuInitMalloc (MALLOC_MAX, spu_malloc_rec);
-			cmn_attr.mask = (SPU_COMMON_MVOLL | SPU_COMMON_MVOLR);
-			cmn_attr.mvol.left = p.MvolL << 7;
-			cmn_attr.mvol.right = p.MvolR << 7;
-			SpuSetCommonAttr(&cmn_attr);
-			SpuSetIRQ(SPU_OFF);
-			return 0;
-		case MUSIC_DA:
-			//memset((u_char*)TEMP_AREA, 0, 400);
-			septrk = CdGetToc((CdlLOC*)TEMP_AREA) - 1;
-			CdControl(CdlDemute, 0, 0);
-			CdControlB(CdlSetfilter, 0, 0);
-			CDReverbEnable();
-			param[0] = CdlModeDA;
-			CdControl(CdlSetmode, param, 0);
-			return 0;
-		case MUSIC_XA:
-			CdControl(CdlDemute, 0, 0);
-			Oldcallback = CdReadyCallback((CdlCB)cbready);
-			CDReverbEnable();
-			return 0;
-		default:
-			return 1;
-		}
-	return 2;
+	MUSICDRIVER* drv = MusicDriver(filetype);
+	// Already set up, e.g. for another track of the same kind
+	if ((Music.State != MUSSTATE_OFF) && (Music.Driver == drv)) {
+		return 0;
+	}
+	if (Music.State != MUSSTATE_OFF) UnloadMusic(Music.Driver->Type);
+	if (drv->Init) drv->Init();
+	Music.Driver = drv;
+	Music.State = MUSSTATE_READY;
+	return 0;
 
 }
 
 int PlayMusic (u_long filetype) {
-	u_char param[4] = {0};
-	u_char result[8] = {0};
-	switch (filetype) {
-		case MUSIC_NONE:
-			return 1;
-		case MUSIC_MOD:
-			MOD_Start();
-			return 1;
-		case MUSIC_SEQ:
-			SsUtReverbOn();
-			SsSeqReplay(seq1);
-			//SsUtReverbOn();
-			return 1;
-		case MUSIC_SEP:
-			SsUtReverbOn();
-			SsSepReplay(sep1, curtrk);
-			//SsUtReverbOn();
-			return 1;
-		/*case MUSIC_VAG:
-			//SpuSetKey(SpuOn,SPU_0CH);
-			SpuSetMute(SPU_OFF);
-			return 1;*/
-		case MUSIC_DA:
-			CdControl(CdlGetlocP, param, result);
-			param[0] = result[5];
-			param[1] = result[6];
-			param[2] = result[7];
-			param[3] = result[0];
-			CdControl(CdlPlay, param, result);
-			return 1;
-		case MUSIC_XA:
-			CdControl(CdlGetlocP, param, result);
-			param[0] = result[5];
-			param[1] = result[6];
-			param[2] = result[7];
-			param[3] = result[0];
-			CdControl(CdlReadS, param, result);
-			return 1;
-		default:
-			return 1;
-		}
-	return 0;
+	MUSICDRIVER* drv = MusicDriver(filetype);
+	// Already playing
+	if ((Music.Driver == drv) && (Music.State == MUSSTATE_OPEN)) {
+		return 1;
+	}
+	if (drv->Play) drv->Play();
+	if ((Music.Driver == drv) && (Music.State == MUSSTATE_PAUSED)) Music.State = MUSSTATE_OPEN;
+	return 1;
 
 }
 
 int PauseMusic (u_long filetype) {
-	
-	switch (filetype) {
-		case MUSIC_NONE:
-			return 0;
-		case MUSIC_MOD:
-			MOD_Stop();
-			return 0;
-		case MUSIC_SEQ:
-			SsSeqPause(seq1);
-			//SsUtReverbOff();
-			return 0;
-		case MUSIC_SEP:
-			SsSepPause(sep1, curtrk);
-			//SsUtReverbOff();
-			return 0;
-		/*case MUSIC_VAG:
-			//SpuSetKey(SpuOff,SPU_0CH);
-			SpuSetMute(SPU_ON);
-			return 0;*/
-		case MUSIC_DA:
-		case MUSIC_XA:
-			CdControlB(CdlPause, 0, 0);
-			return 0;
-		default:
-			return 0;
-		}
-	return 1;
+	MUSICDRIVER* drv = MusicDriver(filetype);
+	// Nothing playing
+	if ((Music.Driver == drv) && (Music.State != MUSSTATE_OPEN)) {
+		return 0;
+	}
+	if (drv->Pause) drv->Pause();
+	if (Music.Driver == drv) Music.State = MUSSTATE_PAUSED;
+	return 0;
 
 }
 
 short ChangeTrack (short nowtrack, u_long filetype) {
-	int loc[2] = {0};
-	switch (filetype) {
-		case MUSIC_NONE:
-		case MUSIC_MOD:
-			return nowtrack;
-		case MUSIC_SEQ:
-			SsSeqClose (seq1);
-			seq1 = SsSeqOpen ((unsigned long*)QLPfilePtr((u_long*)MOD_AREA, nowtrack), vab1);
-			SsUtReverbOn();
-			SsSetMVol (p.MvolL, p.MvolR);
-			SsSeqSetVol (seq1, p.VolL, p.VolR);
-			SsSeqPlay(seq1, SSPLAY_PLAY, (short)p.SeqLoops);
-			return nowtrack;
-		case MUSIC_SEP:
-			SsSepStop(sep1, curtrk);
-			SsUtReverbOn();
-			SsSepPlay(sep1, nowtrack, SSPLAY_PLAY, (short)p.SeqLoops);
-			return nowtrack;
-		case MUSIC_DA:
-			loc[0] = nowtrack + 2;
-			CdPlay(1, loc, 0);
-			return nowtrack;
-		case MUSIC_XA:
-			LoadXA(0, nowtrack, false);
-			return nowtrack;
-		default:
-			return nowtrack;
-		}
+	MUSICDRIVER* drv = MusicDriver(filetype);
+	if (drv->Track) {
+		drv->Track(nowtrack);
+		if (Music.Driver == drv) Music.State = MUSSTATE_OPEN;
+	}
 	return nowtrack;
 }
 
 short ChangeVol (short nowvolL, short nowvolR, u_long filetype) {
-	switch (filetype) {
-		case MUSIC_NONE:
-		case MUSIC_MOD:
-			return (nowvolL + nowvolR) / 2;
-		case MUSIC_SEQ:
-			SsSeqSetVol (seq1, nowvolL, nowvolR);
-			return (nowvolL + nowvolR) / 2;
-		case MUSIC_SEP:
-			SsSepSetVol (sep1, curtrk, nowvolL, nowvolR);
-			return (nowvolL + nowvolR) / 2;
-		case MUSIC_VAG:
-			SpuSetVoiceVolume(SPU_0CH, nowvolL << 7, nowvolR << 7);
-			return (nowvolL + nowvolR) / 2;
-		case MUSIC_DA:
-		case MUSIC_XA:
-			SsSetSerialVol(SS_SERIAL_A, nowvolL, nowvolR);
-			return (nowvolL + nowvolR) / 2;
-		default:
-			return (nowvolL + nowvolR) / 2;
-			break;
-		}
+	MUSICDRIVER* drv = MusicDriver(filetype);
+	if (drv->Vol) drv->Vol(nowvolL, nowvolR);
 	return (nowvolL + nowvolR) / 2;
 }
 
 short ChangeRVol (short nowvolL, short nowvolR, u_long filetype) {
-	switch (filetype) {
-		case MUSIC_NONE:
-		case MUSIC_MOD:
-			return (nowvolL + nowvolR) / 2;
-		case MUSIC_SEQ:
-		case MUSIC_SEP:
-		case MUSIC_DA:
-		case MUSIC_XA:
-			SsSetRVol (nowvolL, nowvolR);
-			return (nowvolL + nowvolR) / 2;	
-		default:
-			return (nowvolL + nowvolR) / 2;
-		}
+	MUSICDRIVER* drv = MusicDriver(filetype);
+	if (drv->RVol) drv->RVol(nowvolL, nowvolR);
 	return (nowvolL + nowvolR) / 2;
 }
 
 int CDRF(char* file, u_long *addr, u_long startsect, u_long nsect) {
-	CdlFILE cdlf;
-	if (startsect == 0) {
-		return CdReadFile(file, addr, nsect << 11); //2048
-	} else {
-		sprintf(StringBuff, "%s;1", file);
-		if (CdSearchFile(&cdlf, StringBuff) == 0) {
-			printf("Subfile not found: %s\n", file);
-			return -1;
-		}
-		CdIntToPos(CdPosToInt(&cdlf.pos) + startsect, &cdlf.pos);
-		CdControl(CdlSetloc, (u_char*)&cdlf.pos, 0);
-		CdRead(nsect, addr, CdlModeSpeed);
-		return nsect << 11;
+	int bytes;
+	bytes = CdIndexSetloc(file, startsect, &nsect); //nsect 0 = whole file
+	if (bytes < 0) {
+		printf("Subfile not found: %s\n", file);
+		return -1;
 	}
+	CdTraceRead(file, nsect, addr, CdlModeSpeed, 0);
+	return bytes;
 }
 
-int CDReverbEnable() {
+void SoundOpen() {
+	
+	// Brings libspu and libsnd up once, with an empty SPU RAM map
+	
+	if (Sound.Up) return;
+	SpuInit();
+	SramInit();
+	
+	SsInit();
+	SsSetTableSize (seq_table, 1, 16);
+	SsSetTickMode(SS_TICKVSYNC);
+	Sound.Tick = SS_TICKVSYNC;
+	Sound.Serial = false;
+	Sound.Up = true;
+	#if DEBUG
+	printf("Sound session opened\n");
+	#endif
+	
+}
+
+void SoundClose() {
+	
+	if (Sound.Up) {
+		SsUtAllKeyOff(0);
+		BankFlush();
+		SsEnd();
+		SsQuit();
+		Sound.Up = false;
+	}
+	SpuQuit();
+	
+}
+
+void SoundTick(short mode) {
+	
+	// The tick mode only takes on SsStart, so stop the ticks when it changes
+	// and let the next SEQ/SEP open start them again
+	
+	if (Sound.Tick == mode) return;
+	SsEnd();
+	SsSetTickMode(mode);
+	Sound.Tick = mode;
+	
+}
+
+void SoundSerial(int on) {
 	CdlATV vol;
 	
-	vol.val0 = 127;
+	if (Sound.Serial == on) return;
+	vol.val0 = (on) ? 127 : 0;
 	vol.val1 = 0;
-	vol.val2 = 127;
+	vol.val2 = (on) ? 127 : 0;
 	vol.val3 = 0;
 	CdMix(&vol);
+	if (on) {
+		SsSetSerialAttr(SS_SERIAL_A, SS_MIX, SS_SON);
+		SsSetSerialAttr(SS_SERIAL_A, SS_REV, SS_SON);
+		SsSetSerialVol(SS_SERIAL_A, p.VolL, p.VolR);
+	} else {
+		SsSetSerialVol(SS_SERIAL_A, 0, 0);
+		SsSetSerialAttr(SS_SERIAL_A, SS_REV, SS_SOFF);
+		SsSetSerialAttr(SS_SERIAL_A, SS_MIX, SS_SOFF);
+	}
+	Sound.Serial = on;
 	
-	SpuInit();
-	SpuSetTransStartAddr(421887);
-	SpuWrite0(1024 * 100);
+}
+
+int CDReverbEnable() {
 	
-	SsInit();
+	SoundOpen();
+	SsUtAllKeyOff(0);
 	SsUtReverbOff();
 	SsUtSetReverbType(0);
 	SsUtSetReverbDepth(0, 0);
-	SsSetTickMode(SS_TICKVSYNC);
 	
 	SsSetMVol(p.MvolL, p.MvolR);
-	SsSetSerialAttr(SS_SERIAL_A, SS_MIX, SS_SON);
-	SsSetSerialAttr(SS_SERIAL_A, SS_REV, SS_SON);
-	SsSetSerialVol(SS_SERIAL_A, p.VolL, p.VolR);
+	SoundSerial(true);
 	
-	SsUtSetReverbType(p.Rmode);
+	SramReverb(p.Rmode);
+	SsUtSetReverbType(Sram.RevMode);
 	SsUtSetReverbDepth(p.RdepthL, p.RdepthR);
 	SsUtSetReverbDelay(p.Rdelay);
 	SsUtSetReverbFeedback(p.Rfeedback);
@@ -2769,110 +6638,98 @@ short DecRDepths (u_long MusType) {
 }
 
 
-short ChangeRevMode (short revmode, u_long filetype) {	
-	switch (filetype) {
-		case MUSIC_NONE:
-			return revmode;
-		case MUSIC_MOD:
-			return revmode;
-		case MUSIC_SEP:
-		case MUSIC_SEQ:
-		case MUSIC_DA:
-		case MUSIC_XA:
-			SpuClearReverbWorkArea(p.Rmode);
-			SsUtReverbOn();
-			SsUtSetReverbType(revmode);
-			return revmode;
-		case MUSIC_VAG:
-			SpuClearReverbWorkArea(p.Rmode);
-			SpuSetReverbModeType(revmode);
-			ChangeRDepth(p.RdepthL, p.RdepthR, filetype);
-			return revmode;
-		default:
-			return revmode;
-		}
-	return -1;
+short ChangeRevMode (short revmode, u_long filetype) {
+	MUSICDRIVER* drv = MusicDriver(filetype);
+	if (drv->RevMode == 0) {
+		return revmode;
+	}
+	drv->RevMode(revmode);
+	return Sram.RevMode;
 }
 
 short ChangeRDepth (short nowvolL, short nowvolR, u_long filetype) {
-	SpuReverbAttr rev_attr;
-	switch (filetype) {
-		case MUSIC_NONE:
-		case MUSIC_MOD:
-			return (nowvolL + nowvolR) / 2;
-		case MUSIC_SEQ:
-		case MUSIC_SEP:
-		case MUSIC_DA:
-		case MUSIC_XA:
-			SsUtSetReverbDepth(nowvolL, nowvolR);
-			return (nowvolL + nowvolR) / 2;
-		case MUSIC_VAG:
-			rev_attr.mask = (SPU_REV_DEPTHL | SPU_REV_DEPTHR);
-			rev_attr.depth.left = nowvolL << 7;
-			rev_attr.depth.right = nowvolR << 7;
-			SpuSetReverbDepth(&rev_attr);
-			return (nowvolL + nowvolR) / 2;
-		default:
-			return (nowvolL + nowvolR) / 2;
-		}
+	MUSICDRIVER* drv = MusicDriver(filetype);
+	if (drv->RDepth) drv->RDepth(nowvolL, nowvolR);
 	return (nowvolL + nowvolR) / 2;
 }
 
 short ChangeDelay (short nowfbdel, u_long filetype) {
-	switch (filetype) {
-		case MUSIC_NONE:
-		case MUSIC_MOD:
-			return nowfbdel;
-		case MUSIC_SEQ:
-		case MUSIC_SEP:
-		case MUSIC_DA:
-		case MUSIC_XA:
-			SsUtSetReverbDelay(nowfbdel);
-			return nowfbdel;
-		case MUSIC_VAG:
-			SpuSetReverbModeDelayTime(nowfbdel);
-			return nowfbdel;
-		default:
-			return nowfbdel;
-		}
+	MUSICDRIVER* drv = MusicDriver(filetype);
+	if (drv->Delay) drv->Delay(nowfbdel);
 	return nowfbdel;
 }
 
 short ChangeFeedback (short nowfbdel, u_long filetype) {
-	switch (filetype) {
-		case MUSIC_NONE:
-		case MUSIC_MOD:
-			return nowfbdel;
-		case MUSIC_SEQ:
-		case MUSIC_SEP:
-		case MUSIC_DA:
-		case MUSIC_XA:
-			SsUtSetReverbFeedback(nowfbdel);
-			return nowfbdel;
-		case MUSIC_VAG:
-			SpuSetReverbModeFeedback(nowfbdel);
-			return nowfbdel;
-		default:
-			return nowfbdel;
-		}
+	MUSICDRIVER* drv = MusicDriver(filetype);
+	if (drv->Feedback) drv->Feedback(nowfbdel);
 	return nowfbdel;
 }
 
-int SeqParamCount (u_long* addr) {
+SEQPACK* SeqView (u_long* addr) {
+	
+	// Works out which files of a SEQ pack are the tracks, the VH/VB pair and
+	// the parameters. Named files are trusted first, otherwise the VH is
+	// guessed from where its magic is in the usual layouts.
+	
+	QLPVIEW*	view=&SeqPack.View;
+	QLPFILE*	entry;
+	u_long		size;
+	int			count,i;
+	
+	if (view->base == addr) {
+		return &SeqPack;
+	}
+	
+	// A VB left on the disc keeps its offset in the pack, which is past the
+	// slot, so the entries are bounded here leaving that one out
+	size = (addr == Slot[1].Addr) ? Slot[1].Size : Slot[0].Size;
+	if (!QLPview(view, addr, (VbStream.Pack == addr) ? 0 : size)) {
+		return 0;
+	}
+	count = view->count;
+	for (i=0; (VbStream.Pack == addr) && (i < count); i++) {
+		entry = view->dir + i;
+		if ((i != VbStream.Vb) && (((entry->addr << 2) + entry->size) > size)) {
+			printf("Bad QLP entry %i at %X\n", i, addr);
+			view->base = 0;
+			return 0;
+		}
+	}
+	
+	SeqPack.Vh = QLPfindExt(view, "vh", 0);
+	if (SeqPack.Vh < 0) {
+		if ((count >= 3) && (*QLPviewPtr(view, count-3) == VH_MAGIC)) {
+			SeqPack.Vh = count-3;	//single parameter file can mean an odd number of files
+		} else if (!(count & 1) && (*QLPviewPtr(view, (count/2)-1) == VH_MAGIC)) {
+			SeqPack.Vh = (count/2)-1;	//multi parameter will always be even (one parameter per seq + vh and vb)
+		} else {
+			SeqPack.Vh = count-2;
+		}
+	}
+	if ((SeqPack.Vh < 1) || ((SeqPack.Vh + 1) >= count)) {
+		view->base = 0;
+		return 0;
+	}
+	SeqPack.Params = count - (SeqPack.Vh + 2);
+	
 	#if DEBUG
-		printf("pBAV = 56414270\nFiles in QLP: %i(%i)\nVH guess for multiparam:%i(%X - %i)\nVH guess for singleparam:%i(%X - %i)\n",
-		QLPfileCount(addr), QLPfileCount(addr) & 1,
-		(QLPfileCount(addr)/2)-1, *QLPfilePtr(addr, (QLPfileCount(addr)/2)-1), *QLPfilePtr(addr, (QLPfileCount(addr)/2)-1)-0x56414270,
-		QLPfileCount(addr)-3, *QLPfilePtr(addr, QLPfileCount(addr)-3), *QLPfilePtr(addr, QLPfileCount(addr)-3)-0x56414270);
+		printf("SEQ pack: %i files, VH %i, %i parameter files\n", count, SeqPack.Vh, SeqPack.Params);
 	#endif
-	if (*QLPfilePtr(addr, QLPfileCount(addr)-3) == 0x56414270) {
-		return 1; //single parameter file can mean an odd number of files
+	
+	return &SeqPack;
+	
+}
+
+int SeqParamCount (u_long* addr) {
+	SEQPACK* pack = SeqView(addr);
+	if (pack == 0) {
+		return 0;
 	}
-	if (QLPfileCount(addr) & 1) {
-		return 0; //avoid integer division errors
+	if (pack->Params == 1) {
+		return 1;
 	}
-	if (*QLPfilePtr(addr, (QLPfileCount(addr)/2)-1) == 0x56414270) {
-		return (QLPfileCount(addr)/2)-1; //multi parameter will always be even (one parameter per seq + vh and vb)
+	if ((pack->Params > 1) && (pack->Params == pack->Vh)) {
+		return pack->Vh; //one parameter file per track
 	}
 	return 0;
 }
@@ -2926,15 +6783,31 @@ short LoadPostParams(PARAMS_HEADER* addr) {
 }
 
 PARAMS_HEADER* ParamFile(u_long stack, u_long *QLP_AREA) {
+	SEQPACK* pack = SeqView(QLP_AREA);
 	int ExtTracks = 0;
-	ExtTracks = SeqParamCount(QLP_AREA);
+	if (pack == 0) {
+		return &ParamsNull;
+	}
+	// Files named as parameters go by track, or one for all of them
+	ExtTracks = QLPextCount(&pack->View, "prm");
 	if (ExtTracks == 1) {
-		ExtTracks = QLPfileCount(QLP_AREA) - 1;
-	} else if (ExtTracks != 0) {
-		ExtTracks += (stack + 2);
-		//printf("QLP File Selected: %i\n", ExtTracks);
+		ExtTracks = QLPfindExt(&pack->View, "prm", 0);
+	} else if (ExtTracks > 1) {
+		ExtTracks = QLPfindExt(&pack->View, "prm", stack);
 	} else {
+		ExtTracks = SeqParamCount(QLP_AREA);
+		if (ExtTracks == 1) {
+			ExtTracks = pack->View.count - 1;
+		} else if (ExtTracks != 0) {
+			ExtTracks += (stack + 2);
+			//printf("QLP File Selected: %i\n", ExtTracks);
+		} else {
+			return &ParamsNull;
+		}
+	}
+	if ((ExtTracks < 0) || (ExtTracks >= pack->View.count)) {
 		return &ParamsNull;
 	}
-	return (PARAMS_HEADER*)QLPfilePtr(QLP_AREA, ExtTracks);
+	PackNeed(QLP_AREA, ExtTracks);
+	return (PARAMS_HEADER*)QLPviewPtr(&pack->View, ExtTracks);
 }
\ No newline at end of file
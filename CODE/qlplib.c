@@ -1,14 +1,48 @@
+#define QLP_MAXFILES	85			// Entries that fit the directory sector
+#define QLP_HASHSIZE	128			// Name buckets, a power of two
+#define QLP_MAXEXT		8			// Different extensions indexed
+
 typedef struct {
 	char	name[16];
 	u_long	size;
 	u_long	addr;
 } QLPFILE;
 
+// Entries sharing an extension, in pack order
+typedef struct {
+	u_long	key;
+	u_char	first;					// Into QLPVIEW order[]
+	u_char	count;
+} QLPEXT;
+
+// A QLP checked once, with the address of every entry worked out and its
+// names and extensions indexed. Entries are used in place, nothing is copied.
+typedef struct {
+	u_long	*base;					// 0 if not a valid QLP
+	int		count;
+	QLPFILE	*dir;
+	u_long	*ptr[QLP_MAXFILES];
+	u_char	hash[QLP_HASHSIZE];		// Entry + 1 by name, 0 for an empty bucket
+	QLPEXT	ext[QLP_MAXEXT];
+	int		exts;
+	u_char	order[QLP_MAXFILES];	// Entries grouped by extension
+} QLPVIEW;
+
 
 int		QLPfileCount(u_long *qlp_ptr);
 QLPFILE	QLPfile(u_long *qlp_ptr, int filenum);
 u_long	*QLPfilePtr(u_long *qlp_ptr, int filenum);
 
+int		QLPview(QLPVIEW *view, u_long *qlp_ptr, u_long size);
+u_long	*QLPviewPtr(QLPVIEW *view, int filenum);
+int		QLPfind(QLPVIEW *view, char *name);
+int		QLPfindExt(QLPVIEW *view, char *ext, int nth);
+int		QLPextCount(QLPVIEW *view, char *ext);
+QLPFILE	*QLPnext(QLPVIEW *view, int *iter);
+u_long	QLPnameHash(char *name);
+u_long	QLPextKey(char *name);
+u_long	QLPextPack(char *ext, int len);
+
 
 int QLPfileCount(u_long *qlp_ptr) {
 	
@@ -26,4 +60,193 @@ u_long *QLPfilePtr(u_long *qlp_ptr, int filenum) {
 	
 	return (qlp_ptr + ((QLPFILE*)(qlp_ptr + 2) + filenum)->addr);
 	
-}
\ No newline at end of file
+}
+
+int QLPview(QLPVIEW *view, u_long *qlp_ptr, u_long size) {
+	
+	// Checks the directory of a QLP and indexes it. With a size the entries
+	// also have to lie within that many bytes. Returns false if the pack
+	// doesn't look right, the view is left empty then.
+	
+	QLPFILE	*entry;
+	u_long	key;
+	int		i,j,h;
+	
+	memset(view, 0, sizeof(QLPVIEW));
+	
+	view->count = QLPfileCount(qlp_ptr);
+	if ((view->count <= 0) || (view->count > QLP_MAXFILES)) {
+		printf("Bad QLP directory at %X: %i entries\n", qlp_ptr, view->count);
+		view->count = 0;
+		return 0;
+	}
+	view->dir = (QLPFILE*)(qlp_ptr + 2);
+	
+	for (i=0; i<view->count; i++) {
+		
+		entry = view->dir + i;
+		if ((size > 0) && (((entry->addr << 2) + entry->size) > size)) {
+			printf("Bad QLP entry %i at %X\n", i, qlp_ptr);
+			view->count = 0;
+			return 0;
+		}
+		view->ptr[i] = qlp_ptr + entry->addr;
+		
+		// First entry of a name wins
+		h = QLPnameHash(entry->name) & (QLP_HASHSIZE - 1);
+		while (view->hash[h] != 0) {
+			if (strncmp(view->dir[view->hash[h] - 1].name, entry->name, 16) == 0) break;
+			h = (h + 1) & (QLP_HASHSIZE - 1);
+		}
+		if (view->hash[h] == 0) view->hash[h] = i + 1;
+		
+		// Count the extensions, packs only ever use a few
+		key = QLPextKey(entry->name);
+		for (j=0; j<view->exts; j++) {
+			if (view->ext[j].key == key) break;
+		}
+		if (j == view->exts) {
+			if (j == QLP_MAXEXT) continue;
+			view->ext[j].key = key;
+			view->exts++;
+		}
+		view->ext[j].count++;
+		
+	}
+	
+	for (i=1; i<view->exts; i++) {
+		view->ext[i].first = view->ext[i - 1].first + view->ext[i - 1].count;
+	}
+	for (j=0; j<view->exts; j++) {
+		view->ext[j].count = 0;
+	}
+	for (i=0; i<view->count; i++) {
+		key = QLPextKey(view->dir[i].name);
+		for (j=0; j<view->exts; j++) {
+			if (view->ext[j].key == key) {
+				view->order[view->ext[j].first + view->ext[j].count++] = i;
+				break;
+			}
+		}
+	}
+	
+	view->base = qlp_ptr;
+	return 1;
+	
+}
+
+u_long *QLPviewPtr(QLPVIEW *view, int filenum) {
+	
+	if ((filenum < 0) || (filenum >= view->count)) return 0;
+	return view->ptr[filenum];
+	
+}
+
+int QLPfind(QLPVIEW *view, char *name) {
+	
+	// Returns the entry with a name, -1 if there is none. Case matters.
+	
+	int	h=QLPnameHash(name) & (QLP_HASHSIZE - 1);
+	
+	while (view->hash[h] != 0) {
+		if (strncmp(view->dir[view->hash[h] - 1].name, name, 16) == 0) return view->hash[h] - 1;
+		h = (h + 1) & (QLP_HASHSIZE - 1);
+	}
+	
+	return -1;
+	
+}
+
+int QLPfindExt(QLPVIEW *view, char *ext, int nth) {
+	
+	// Returns the nth entry with an extension ("vh" or ".vh", any case), -1
+	// if there aren't that many. Entries without one have the extension "".
+	
+	u_long	key=QLPextPack(ext, 5);
+	int		j;
+	
+	for (j=0; j<view->exts; j++) {
+		if (view->ext[j].key == key) {
+			if ((nth < 0) || (nth >= view->ext[j].count)) return -1;
+			return view->order[view->ext[j].first + nth];
+		}
+	}
+	
+	return -1;
+	
+}
+
+int QLPextCount(QLPVIEW *view, char *ext) {
+	
+	u_long	key=QLPextPack(ext, 5);
+	int		j;
+	
+	for (j=0; j<view->exts; j++) {
+		if (view->ext[j].key == key) return view->ext[j].count;
+	}
+	
+	return 0;
+	
+}
+
+QLPFILE *QLPnext(QLPVIEW *view, int *iter) {
+	
+	// Steps through the entries in pack order, start with *iter at 0.
+	// Returns 0 after the last one.
+	
+	if ((*iter < 0) || (*iter >= view->count)) return 0;
+	return view->dir + (*iter)++;
+	
+}
+
+u_long QLPnameHash(char *name) {
+	
+	u_long	h=5381;
+	int		i;
+	
+	for (i=0; (i<16) && (name[i] != 0); i++) {
+		h = ((h << 5) + h) ^ (u_char)name[i];
+	}
+	
+	return h;
+	
+}
+
+u_long QLPextKey(char *name) {
+	
+	// Packs the extension of an entry name, see QLPextPack()
+	
+	int	i,dot=-1;
+	
+	for (i=0; (i<16) && (name[i] != 0); i++) {
+		if (name[i] == '.') dot = i;
+	}
+	if (dot < 0) return 0;
+	
+	return QLPextPack(name + dot + 1, 15 - dot);
+	
+}
+
+u_long QLPextPack(char *ext, int len) {
+	
+	// Packs up to 4 characters of an extension in upper case, a leading dot
+	// is skipped
+	
+	u_long	key=0;
+	int		i;
+	char	c;
+	
+	if (*ext == '.') {
+		ext++;
+		len--;
+	}
+	
+	for (i=0; (i<len) && (i<4) && (ext[i] != 0); i++) {
+		c = ext[i];
+		if ((c >= 'a') && (c <= 'z')) c -= 'a' - 'A';
+		key = (key << 8) | (u_char)c;
+	}
+	
+	return key;
+	
+}
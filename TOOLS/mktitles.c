@@ -0,0 +1,144 @@
+// mktitles - compiles a PSFMenu TITLES.TXT into a TITLES.BIN
+//
+// Build with any host C compiler, e.g.: gcc -O2 -o mktitles mktitles.c
+// Usage: mktitles TITLES.TXT TITLES.BIN
+//
+// The text is read the same way the menu reads it: only text between quotes
+// counts, and every three quoted strings make an entry (name, file, stack
+// address in hex). Identical strings are only stored once, and the end of
+// file character (0x80) ends the list as documented in TITLES.TXT.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_TITLES		10240
+#define NAME_MAX		63
+#define FILE_MAX		51
+#define STRINGS_MAX		(MAX_TITLES * (NAME_MAX + FILE_MAX + 2))
+
+#define TITLESBIN_VERSION	1
+
+typedef struct {
+	unsigned long	StackAddr;
+	unsigned long	Name;
+	unsigned long	ExecFile;
+} ENTRY;
+
+
+ENTRY	Entry[MAX_TITLES];
+int		NumEntries=0;
+
+char	Strings[STRINGS_MAX];
+int		StringsSize=0;
+
+
+unsigned long AddString(char *string) {
+
+	// Returns the offset of a string in the table, adding it if needed
+
+	int i,len=strlen(string);
+
+	for (i=0; i<StringsSize; i+=strlen(Strings+i)+1) {
+		if (strcmp(Strings+i, string) == 0) return i;
+	}
+
+	memcpy(Strings+StringsSize, string, len+1);
+	StringsSize += len+1;
+
+	return i;
+
+}
+
+void PutLong(FILE *fp, unsigned long value) {
+
+	// The PlayStation is little endian no matter what this runs on
+
+	fputc(value & 0xff, fp);
+	fputc((value >> 8) & 0xff, fp);
+	fputc((value >> 16) & 0xff, fp);
+	fputc((value >> 24) & 0xff, fp);
+
+}
+
+int main(int argc, char *argv[]) {
+
+	FILE	*fp;
+	char	Field[3][NAME_MAX+1];
+	int		c,i,InQuote=0,GrabStep=0,CharNum=0,Max=NAME_MAX;
+
+	if (argc != 3) {
+		printf("Usage: mktitles TITLES.TXT TITLES.BIN\n");
+		return 1;
+	}
+
+	if ((fp = fopen(argv[1], "rb")) == NULL) {
+		printf("Cannot open %s\n", argv[1]);
+		return 1;
+	}
+
+	// Scan the file's text
+	while ((c = fgetc(fp)) != EOF) {
+
+		if ((c == 0) || (c == 0x80)) break;
+
+		if (InQuote == 0) {
+			if (c == '"') {
+				CharNum = 0;
+				InQuote = 1;
+				Max = (GrabStep == 0) ? NAME_MAX : (GrabStep == 1) ? FILE_MAX : 8;
+			}
+			continue;
+		}
+
+		if (c != '"') {
+			if (CharNum < Max) Field[GrabStep][CharNum++] = c;
+			continue;
+		}
+
+		Field[GrabStep][CharNum] = 0;
+		InQuote = 0;
+
+		if (++GrabStep < 3) continue;
+		GrabStep = 0;
+
+		if (NumEntries == MAX_TITLES) {
+			printf("More than %i entries, the rest are left out\n", MAX_TITLES);
+			break;
+		}
+		Entry[NumEntries].Name = AddString(Field[0]);
+		Entry[NumEntries].ExecFile = AddString(Field[1]);
+		Entry[NumEntries].StackAddr = strtoul(Field[2], NULL, 16);
+		NumEntries++;
+
+	}
+
+	fclose(fp);
+
+	if ((fp = fopen(argv[2], "wb")) == NULL) {
+		printf("Cannot create %s\n", argv[2]);
+		return 1;
+	}
+
+	// Header, see TITLESBIN in mmenu.c
+	fwrite("TBIN", 1, 4, fp);
+	PutLong(fp, TITLESBIN_VERSION);
+	PutLong(fp, NumEntries);
+	PutLong(fp, StringsSize);
+
+	for (i=0; i<NumEntries; i++) {
+		PutLong(fp, Entry[i].StackAddr);
+		PutLong(fp, Entry[i].Name);
+		PutLong(fp, Entry[i].ExecFile);
+		PutLong(fp, 0);		// SectorStart, text lists don't have any
+		PutLong(fp, 0);		// SectorLength
+	}
+
+	fwrite(Strings, 1, StringsSize, fp);
+	fclose(fp);
+
+	printf("%i entries, %i bytes of strings\n", NumEntries, StringsSize);
+
+	return 0;
+
+}
@@ -0,0 +1,392 @@
+// mkvfs - packs the files of a PSFMenu list into a VFS v2 pack
+//
+// Build with any host C compiler, e.g.: gcc -O2 -o mkvfs mkvfs.c
+// Usage: mkvfs LIST.TXT PACK.VFS
+//        mkvfs -patch PACK.VFS LBA
+//
+// The list is read like TITLES.TXT: every three quoted strings make an entry
+// (name, file on this computer, stack address in hex). Each file starts on a
+// sector of its own in the pack, after the directory.
+//
+// XA files are packed as they are given, in raw 2336-byte sectors. A pack
+// holding any is written as Mode 2 sectors throughout: the directory and the
+// other files go in Form 1 sectors with a data subheader, their EDC/ECC left
+// for the mastering tool to fill in like for any other XA file.
+//
+// Once the pack has a place on the disc image, -patch writes its first
+// sector into the header and every entry so the menu never has to search the
+// disc for it. Patch it again whenever the image is rebuilt.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_ENTRIES		10240
+#define NAME_MAX		63
+#define FILE_MAX		255
+
+#define VFS_VERSION		2
+#define HEAD_SIZE		24
+#define ENTRY_SIZE		92
+
+// Stack addresses, see mmenu.c
+#define MUSIC_XA		0xFFFFFF06
+#define XA_MIN			0x00FFFF00
+#define XA_MAX			0x00FFFFFF
+#define SEP_MIN			0x01000000
+#define SEP_MAX			0x0100FFFF
+#define SEQ_MIN			0x01010000
+#define SEQ_MAX			0x0101FFFF
+#define EXE_MAX			0x80200000	// Above this it's one of the MUSIC_*/MENU_* types
+
+#define XAINFO_KNOWN	0x80
+#define XAINFO_2X		0x40
+#define XAINFO_CHANS	0x1F
+
+#define XA_SECTOR		2336		// Raw XA sector, subheader included
+#define XA_SUBHEAD		8
+#define XA_EDC			280			// EDC/ECC of a Form 1 sector
+#define SUBMODE_DATA	0x08
+
+typedef struct {
+	char			Name[NAME_MAX+1];
+	char			File[FILE_MAX+1];
+	unsigned long	Size;
+	unsigned long	Addr;
+	unsigned long	Sectors;
+	unsigned long	Stack;
+	unsigned long	Type;
+	unsigned long	Sub;
+	int				Xa;
+} ENTRY;
+
+
+ENTRY	Entry[MAX_ENTRIES];
+int		NumEntries=0;
+int		Raw=0;		// Written as Mode 2 sectors, the pack holds XA
+
+
+void PutLong(FILE *fp, unsigned long value) {
+
+	// The PlayStation is little endian no matter what this runs on
+
+	fputc(value & 0xff, fp);
+	fputc((value >> 8) & 0xff, fp);
+	fputc((value >> 16) & 0xff, fp);
+	fputc((value >> 24) & 0xff, fp);
+
+}
+
+unsigned long GetLong(unsigned char *p) {
+
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned long)p[3] << 24);
+
+}
+
+void SetLong(unsigned char *p, unsigned long value) {
+
+	p[0] = value & 0xff;
+	p[1] = (value >> 8) & 0xff;
+	p[2] = (value >> 16) & 0xff;
+	p[3] = (value >> 24) & 0xff;
+
+}
+
+long SectorOffset(unsigned long sect) {
+
+	// Where the data of a sector of the pack is in the file
+
+	return Raw ? (sect * XA_SECTOR) + XA_SUBHEAD : sect * 2048;
+
+}
+
+void PutSector(FILE *fp, unsigned char *data) {
+
+	// Writes a sector of pack data, as a Form 1 sector if the pack is raw
+
+	static unsigned char	sub[XA_SUBHEAD]={0, 0, SUBMODE_DATA, 0, 0, 0, SUBMODE_DATA, 0};
+	static unsigned char	edc[XA_EDC];
+
+	if (Raw) fwrite(sub, 1, XA_SUBHEAD, fp);
+	fwrite(data, 1, 2048, fp);
+	if (Raw) fwrite(edc, 1, XA_EDC, fp);
+
+}
+
+int IsXa(ENTRY *e) {
+
+	return (e->Type == XA_MIN) || (e->Type == MUSIC_XA);
+
+}
+
+void EntryType(ENTRY *e) {
+
+	// Splits a stack address into the type and track the menu would work out
+
+	e->Type = e->Stack;
+	e->Sub = 0;
+	if ((e->Stack >= SEP_MIN) && (e->Stack <= SEP_MAX)) {
+		e->Type = SEP_MIN;
+	} else if ((e->Stack >= SEQ_MIN) && (e->Stack <= SEQ_MAX)) {
+		e->Type = SEQ_MIN;
+	} else if ((e->Stack >= XA_MIN) && (e->Stack <= XA_MAX)) {
+		e->Type = XA_MIN;
+	} else if (e->Stack < EXE_MAX) {
+		e->Type = 0;	// EXE, the stack address is kept as is
+	}
+	if (e->Type != e->Stack) {
+		e->Sub = e->Stack - e->Type;
+	}
+
+}
+
+int XaInfo(FILE *fp, unsigned long size) {
+
+	// Works out the highest channel of an XA file given as raw sectors and
+	// whether it needs double speed, the same way XASpeed() does on the
+	// console. Returns 0 if it can't tell.
+
+	unsigned char	sub[8];
+	unsigned long	sect,count=size / XA_SECTOR;
+	int				file=-1,chan=-1,high=0,first=-1,gap=-1,base=8;
+
+	if ((size == 0) || ((size % XA_SECTOR) != 0)) return 0;
+
+	for (sect=0; sect<count; sect++) {
+		fseek(fp, sect * XA_SECTOR, SEEK_SET);
+		if (fread(sub, 1, 8, fp) != 8) break;
+		if (sub[1] > high) high = sub[1];
+		if ((sub[2] & 0x04) == 0) continue;		// Not audio
+		if (file < 0) {
+			file = sub[0];
+			chan = sub[1];
+		}
+		if ((sub[0] != file) || (sub[1] != chan)) continue;
+		if (first < 0) {
+			first = sect;
+			if (sub[3] & 0x01) base /= 2;		// Stereo
+			if (sub[3] & 0x04) base *= 2;		// 18.9KHz
+		} else if (gap < 0) {
+			gap = sect - first;
+		}
+	}
+	fseek(fp, 0, SEEK_SET);
+
+	if (high > XAINFO_CHANS) return 0;
+	if (gap == base) return XAINFO_KNOWN | high;
+	if (gap == (base * 2)) return XAINFO_KNOWN | XAINFO_2X | high;
+	return 0;
+
+}
+
+int Patch(char *pack, unsigned long lba) {
+
+	// Writes where the pack is on the disc into its header and entries
+
+	FILE			*fp;
+	unsigned char	head[XA_SUBHEAD + HEAD_SIZE];
+	unsigned char	*dir,*entry;
+	unsigned long	i,n,count,sects;
+
+	if ((fp = fopen(pack, "r+b")) == NULL) {
+		printf("Cannot open %s\n", pack);
+		return 1;
+	}
+	n = fread(head, 1, sizeof(head), fp);
+	Raw = (n == sizeof(head)) && (memcmp(head + XA_SUBHEAD, "VFS2", 4) == 0);
+	if ((Raw == 0) && ((n < HEAD_SIZE) || (memcmp(head, "VFS2", 4) != 0))) {
+		printf("%s is not a VFS v2 pack\n", pack);
+		fclose(fp);
+		return 1;
+	}
+
+	// The directory may span sectors, Mode 2 ones have gaps between them
+	sects = GetLong(head + (Raw ? XA_SUBHEAD : 0) + 8);
+	if ((dir = calloc(sects, 2048)) == NULL) {
+		printf("Out of memory\n");
+		fclose(fp);
+		return 1;
+	}
+	for (i=0; i<sects; i++) {
+		fseek(fp, SectorOffset(i), SEEK_SET);
+		if (fread(dir + (i * 2048), 1, 2048, fp) != 2048) break;
+	}
+	count = GetLong(dir + 4);
+	if ((i < sects) || (count > ((sects * 2048) - HEAD_SIZE) / ENTRY_SIZE)) {
+		printf("%s is cut short\n", pack);
+		free(dir);
+		fclose(fp);
+		return 1;
+	}
+
+	SetLong(dir + 16, lba);
+	for (i=0; i<count; i++) {
+		entry = dir + HEAD_SIZE + (i * ENTRY_SIZE);
+		SetLong(entry + 76, lba + GetLong(entry + 68));
+	}
+
+	for (i=0; i<sects; i++) {
+		fseek(fp, SectorOffset(i), SEEK_SET);
+		fwrite(dir + (i * 2048), 1, 2048, fp);
+	}
+
+	free(dir);
+	fclose(fp);
+	printf("%s patched to LBA %lu\n", pack, lba);
+
+	return 0;
+
+}
+
+int main(int argc, char *argv[]) {
+
+	FILE			*fp,*in;
+	char			Field[3][FILE_MAX+1];
+	unsigned char	Buff[XA_SECTOR];
+	unsigned char	*Dir,*p;
+	unsigned long	DirSectors,Sector,n;
+	int				c,i,InQuote=0,GrabStep=0,CharNum=0,Max=NAME_MAX;
+
+	if ((argc == 4) && (strcmp(argv[1], "-patch") == 0)) {
+		return Patch(argv[2], strtoul(argv[3], NULL, 0));
+	}
+
+	if (argc != 3) {
+		printf("Usage: mkvfs LIST.TXT PACK.VFS\n");
+		printf("       mkvfs -patch PACK.VFS LBA\n");
+		return 1;
+	}
+
+	if ((fp = fopen(argv[1], "rb")) == NULL) {
+		printf("Cannot open %s\n", argv[1]);
+		return 1;
+	}
+
+	// Scan the list's text
+	while ((c = fgetc(fp)) != EOF) {
+
+		if ((c == 0) || (c == 0x80)) break;
+
+		if (InQuote == 0) {
+			if (c == '"') {
+				CharNum = 0;
+				InQuote = 1;
+				Max = (GrabStep == 0) ? NAME_MAX : (GrabStep == 1) ? FILE_MAX : 8;
+			}
+			continue;
+		}
+
+		if (c != '"') {
+			if (CharNum < Max) Field[GrabStep][CharNum++] = c;
+			continue;
+		}
+
+		Field[GrabStep][CharNum] = 0;
+		InQuote = 0;
+
+		if (++GrabStep < 3) continue;
+		GrabStep = 0;
+
+		if (NumEntries == MAX_ENTRIES) {
+			printf("More than %i entries, the rest are left out\n", MAX_ENTRIES);
+			break;
+		}
+		strcpy(Entry[NumEntries].Name, Field[0]);
+		strcpy(Entry[NumEntries].File, Field[1]);
+		Entry[NumEntries].Stack = strtoul(Field[2], NULL, 16);
+		EntryType(&Entry[NumEntries]);
+		NumEntries++;
+
+	}
+
+	fclose(fp);
+
+	// Lay the files out after the directory. XA files keep their raw
+	// sectors, which makes the whole pack Mode 2.
+	DirSectors = (HEAD_SIZE + (NumEntries * ENTRY_SIZE) + 2047) / 2048;
+	Sector = DirSectors;
+	for (i=0; i<NumEntries; i++) {
+		if ((in = fopen(Entry[i].File, "rb")) == NULL) {
+			printf("Cannot open %s\n", Entry[i].File);
+			return 1;
+		}
+		fseek(in, 0, SEEK_END);
+		Entry[i].Size = ftell(in);
+		Entry[i].Addr = Sector;
+		Entry[i].Sectors = (Entry[i].Size + 2047) / 2048;
+		if (IsXa(&Entry[i])) {
+			if ((Entry[i].Size == 0) || ((Entry[i].Size % XA_SECTOR) != 0)) {
+				printf("%s is not in raw %i-byte XA sectors\n", Entry[i].File, XA_SECTOR);
+				fclose(in);
+				return 1;
+			}
+			Entry[i].Sectors = Entry[i].Size / XA_SECTOR;
+			Entry[i].Xa = XaInfo(in, Entry[i].Size);
+			if (Entry[i].Xa == 0) printf("Can't tell the interleave of %s\n", Entry[i].File);
+			Raw = 1;
+		}
+		fclose(in);
+		Sector += Entry[i].Sectors;
+	}
+
+	// Header and entries, see VFSHEAD and VFSFILE2 in mmenu.c
+	if ((Dir = calloc(DirSectors, 2048)) == NULL) {
+		printf("Out of memory\n");
+		return 1;
+	}
+	memcpy(Dir, "VFS2", 4);
+	SetLong(Dir + 4, NumEntries);
+	SetLong(Dir + 8, DirSectors);
+	SetLong(Dir + 12, VFS_VERSION);
+	SetLong(Dir + 16, 0);			// LBA, see Patch()
+	SetLong(Dir + 20, Sector * 2048);
+
+	for (i=0; i<NumEntries; i++) {
+		p = Dir + HEAD_SIZE + (i * ENTRY_SIZE);
+		strcpy((char*)p, Entry[i].Name);
+		SetLong(p + 64, Entry[i].Size);
+		SetLong(p + 68, Entry[i].Addr);
+		SetLong(p + 72, Entry[i].Sectors);
+		SetLong(p + 76, 0);			// LBA
+		SetLong(p + 80, (Entry[i].Type == 0) ? Entry[i].Stack : 0);
+		SetLong(p + 84, Entry[i].Type);
+		p[88] = Entry[i].Sub & 0xff;
+		p[89] = (Entry[i].Sub >> 8) & 0xff;
+		p[90] = Entry[i].Xa;
+		p[91] = 0;
+	}
+
+	if ((fp = fopen(argv[2], "wb")) == NULL) {
+		printf("Cannot create %s\n", argv[2]);
+		free(Dir);
+		return 1;
+	}
+
+	for (n=0; n<DirSectors; n++) {
+		PutSector(fp, Dir + (n * 2048));
+	}
+	free(Dir);
+
+	// Pad every file to a whole sector, XA sectors are copied as they are
+	for (i=0; i<NumEntries; i++) {
+		in = fopen(Entry[i].File, "rb");
+		if (IsXa(&Entry[i])) {
+			while (fread(Buff, 1, XA_SECTOR, in) == XA_SECTOR) {
+				fwrite(Buff, 1, XA_SECTOR, fp);
+			}
+		} else {
+			while ((n = fread(Buff, 1, 2048, in)) > 0) {
+				if (n < 2048) memset(Buff + n, 0, 2048 - n);
+				PutSector(fp, Buff);
+			}
+		}
+		fclose(in);
+	}
+
+	fclose(fp);
+
+	printf("%i entries, %lu sectors%s\n", NumEntries, Sector, Raw ? ", Mode 2" : "");
+
+	return 0;
+
+}